@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "arena.h"
+#include "parser.h"
+#include "executor.h"
+#include "input.h"
+#include "jobs.h"
+#include "variables.h"
+
+#define TARGET_SECONDS 0.3
+#define MIN_SAMPLES 20
+#define MAX_SAMPLES 20000
+#define BATCH_ROUNDS 15
+
+extern char **environ;
+
+/* Latencies of one case, in nanoseconds. */
+typedef struct {
+    double values[MAX_SAMPLES];
+    int count;
+} Samples;
+
+static Samples samples;
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(Samples *s, int percent) {
+    qsort(s->values, s->count, sizeof(double), compare_doubles);
+    return s->values[(s->count - 1) * percent / 100];
+}
+
+/* Keeps sampling until TARGET_SECONDS have passed and there are at least
+ * MIN_SAMPLES, or the buffer is full. */
+static bool sampling(double start) {
+    if (samples.count >= MAX_SAMPLES) return false;
+    return samples.count < MIN_SAMPLES || now_ns() - start < TARGET_SECONDS * 1e9;
+}
+
+static const struct {
+    const char *name;
+    const char *line;
+} corpus[] = {
+    { "simple", "ls -la /usr/local/bin" },
+    { "pipeline", "cat access.log | grep -v healthcheck | cut -d' ' -f1 | sort | uniq -c | sort -rn | head -20" },
+    { "redirections", "make -j8 all > build.log 2>&1 < /dev/null && echo done >> status.txt" },
+    { "quoting", "printf '%s\\n' \"$HOME/projects\" 'single quoted; | &' \"nested $(basename \\\"$PWD\\\")\" \\$escaped" },
+    { "compound", "for f in src/*.c; do if [ -f \"$f\" ]; then gcc -O2 -c \"$f\" -o \"build/${f%.c}.o\" || exit 1; fi; done" },
+    { "background", "sleep 1 & sleep 2 & sleep 3 & wait; echo all done" },
+};
+
+#define CORPUS_COUNT (int)(sizeof(corpus) / sizeof(corpus[0]))
+
+static char *repeat(const char *unit, int count, const char *separator) {
+    size_t unit_length = strlen(unit), separator_length = strlen(separator);
+    char *text = malloc(count * (unit_length + separator_length) + 1);
+    size_t length = 0;
+    for (int i = 0; i < count; ++i) {
+        memcpy(text + length, unit, unit_length);
+        length += unit_length;
+        if (i < count - 1) {
+            memcpy(text + length, separator, separator_length);
+            length += separator_length;
+        }
+    }
+    text[length] = '\0';
+    return text;
+}
+
+static void bench_tokenize(const char *name, const char *line) {
+    Arena arena;
+    arena_init(&arena);
+    size_t bytes = strlen(line);
+    int tokens = 0;
+
+    samples.count = 0;
+    double start = now_ns();
+    while (sampling(start)) {
+        arena_reset(&arena);
+        double t0 = now_ns();
+        TokenArray *array = tokenize(&arena, line);
+        samples.values[samples.count++] = now_ns() - t0;
+        tokens = array->length;
+    }
+    double median = percentile(&samples, 50);
+    printf("tokenize case=%s bytes=%zu tokens=%d median_ns=%.0f p99_ns=%.0f bytes_per_sec=%.0f\n",
+            name, bytes, tokens, median, percentile(&samples, 99), bytes / (median / 1e9));
+    arena_free(&arena);
+}
+
+static int count_nodes(ASTNode *node) {
+    if (!node) return 0;
+    int count = 1 + count_nodes(node->left) + count_nodes(node->right);
+    for (int i = 0; i < node->child_count; ++i) count += count_nodes(node->children[i]);
+    return count;
+}
+
+/* Trees live in an arena, so freeing one is an arena_reset. */
+static void bench_parse(const char *name, const char *line) {
+    Arena arena;
+    arena_init(&arena);
+    Samples frees;
+    frees.count = 0;
+    int nodes = 0;
+
+    samples.count = 0;
+    double start = now_ns();
+    while (sampling(start)) {
+        TokenArray *array = tokenize(&arena, line);
+        double t0 = now_ns();
+        ASTNode *ast = parse_expression(array);
+        samples.values[samples.count++] = now_ns() - t0;
+        nodes = count_nodes(ast);
+
+        t0 = now_ns();
+        arena_reset(&arena);
+        frees.values[frees.count++] = now_ns() - t0;
+    }
+    if (!nodes) nodes = 1;
+    double median = percentile(&samples, 50);
+    printf("parse case=%s nodes=%d median_ns=%.0f p99_ns=%.0f ns_per_node=%.1f free_median_ns=%.0f "
+            "free_p99_ns=%.0f\n", name, nodes, median, percentile(&samples, 99), median / nodes,
+            percentile(&frees, 50), percentile(&frees, 99));
+    arena_free(&arena);
+}
+
+static void bench_execute(const char *name, const char *line) {
+    Arena arena;
+    arena_init(&arena);
+    Program *program = compile_ast(&arena, parse_expression(tokenize(&arena, line)));
+
+    samples.count = 0;
+    double start = now_ns();
+    while (sampling(start)) {
+        double t0 = now_ns();
+        execute_program(program);
+        samples.values[samples.count++] = now_ns() - t0;
+    }
+    printf("execute case=%s samples=%d median_ns=%.0f p99_ns=%.0f\n", name, samples.count,
+            percentile(&samples, 50), percentile(&samples, 99));
+    arena_free(&arena);
+}
+
+/* Runs a whole script through the shell loop, as a script file would be. */
+static void bench_batch(const char *name, const char *script, int lines) {
+    samples.count = 0;
+    for (int round = 0; round < BATCH_ROUNDS; ++round) {
+        Input input;
+        input_open_string(&input, script);
+        double t0 = now_ns();
+        shell_loop(&input);
+        samples.values[samples.count++] = now_ns() - t0;
+        input_close(&input);
+    }
+    double median = percentile(&samples, 50);
+    printf("batch case=%s lines=%d rounds=%d median_ns=%.0f p99_ns=%.0f lines_per_sec=%.0f\n", name, lines,
+            BATCH_ROUNDS, median, percentile(&samples, 99), lines / (median / 1e9));
+}
+
+static char *numbered_script(const char *format, int lines) {
+    size_t capacity = lines * (strlen(format) + 16) + 1;
+    char *script = malloc(capacity);
+    size_t length = 0;
+    for (int i = 0; i < lines; ++i) length += snprintf(script + length, capacity - length, format, i, i);
+    return script;
+}
+
+int main(void) {
+    shell_pid = getpid();
+    vars_init(environ);
+    jobs_init();
+
+    for (int i = 0; i < CORPUS_COUNT; ++i) bench_tokenize(corpus[i].name, corpus[i].line);
+
+    struct {
+        const char *name;
+        char *line;
+    } pathological[] = {
+        { "long_word_64k", repeat("x", 65536, "") },
+        { "many_words_64k", repeat("ab", 21845, " ") },
+        { "operators_16k", repeat("a", 4096, "|&;") },
+        { "quotes_16k", repeat("\"a b\" 'c d' \\e", 1024, " ") },
+        { "substitutions_16k", repeat("$(echo `x`)", 1500, " ") },
+    };
+    int pathological_count = (int)(sizeof(pathological) / sizeof(pathological[0]));
+    for (int i = 0; i < pathological_count; ++i) bench_tokenize(pathological[i].name, pathological[i].line);
+
+    for (int i = 0; i < CORPUS_COUNT; ++i) bench_parse(corpus[i].name, corpus[i].line);
+    char *long_pipeline = repeat("cmd arg", 256, " | ");
+    char *long_list = repeat("a && b || c", 256, "; ");
+    bench_parse("pipeline_256", long_pipeline);
+    bench_parse("list_256", long_list);
+
+    bench_execute("spawn", "/bin/true");
+    bench_execute("builtin", "true");
+    char *pipelines[] = { repeat("/bin/true", 2, " | "), repeat("/bin/true", 4, " | "), repeat("/bin/true", 8, " | ") };
+    bench_execute("pipeline_2", pipelines[0]);
+    bench_execute("pipeline_4", pipelines[1]);
+    bench_execute("pipeline_8", pipelines[2]);
+    char *fanout = repeat("/bin/true &", 16, " ");
+    char *fanout_wait = malloc(strlen(fanout) + 8);
+    sprintf(fanout_wait, "%s wait", fanout);
+    /* Enough slots that no job queues: this measures launching, not the
+     * scheduler, and keeps its throughput report off stderr. */
+    shell_options.max_jobs = 16;
+    bench_execute("fanout_16", fanout_wait);
+
+    char *builtin_script = numbered_script("x%d=%d; [ -n \"$x0\" ] && y=$x0\n", 2000);
+    char *external_script = numbered_script("/bin/true %d %d\n", 200);
+    bench_batch("builtins", builtin_script, 2000);
+    bench_batch("external", external_script, 200);
+
+    for (int i = 0; i < pathological_count; ++i) free(pathological[i].line);
+    for (int i = 0; i < 3; ++i) free(pipelines[i]);
+    free(long_pipeline);
+    free(long_list);
+    free(fanout);
+    free(fanout_wait);
+    free(builtin_script);
+    free(external_script);
+    return 0;
+}
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include "lexer.h"
+#include "scan.h"
+
+#define TARGET_SECONDS 0.2
+
+static char *make_line(int size, int min_word, int max_word) {
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789/_.-=,:";
+    char *line = malloc(size + 1);
+    int length = 0;
+    unsigned seed = 12345;
+
+    while (length < size) {
+        seed = seed * 1103515245 + 12345;
+        int word = min_word + (int)((seed >> 16) % (unsigned)(max_word - min_word + 1));
+        for (int i = 0; i < word && length < size; ++i) {
+            seed = seed * 1103515245 + 12345;
+            line[length++] = alphabet[(seed >> 16) % (sizeof(alphabet) - 1)];
+        }
+        if (length < size) line[length++] = ' ';
+    }
+    line[size] = '\0';
+    return line;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long lex_line(const char *line) {
+    Lexer lexer;
+    Token token;
+    long tokens = 0;
+
+    lexer_init(&lexer, line);
+    do {
+        token = lexer_next_token(&lexer);
+        tokens++;
+    } while (token.type != TOKEN_EOF && token.type != TOKEN_ERROR);
+    return tokens;
+}
+
+/* The word and whitespace loops of the lexer before the scan module, with
+ * one isspace/strchr test per byte. Operators are single-byte tokens. */
+static long original_lex_line(const char *line) {
+    int length = strlen(line);
+    int position = 0;
+    long tokens = 0;
+
+    while (1) {
+        while (position < length && isspace((unsigned char)line[position])) position++;
+        tokens++;
+        if (position >= length) break;
+        if (strchr("|&;<>()", line[position])) {
+            position++;
+            continue;
+        }
+
+        while (position < length) {
+            char c = line[position];
+            if (isspace((unsigned char)c) || strchr("|&;<>()", c)) break;
+            if (c == '"' || c == '\'') {
+                position++;
+                while (position < length && line[position] != c) {
+                    if (c == '"' && line[position] == '\\' && position + 1 < length) position++;
+                    position++;
+                }
+                if (position >= length) return tokens;
+                position++;
+                continue;
+            }
+            if (c == '\\' && position + 1 < length) position++;
+            position++;
+        }
+    }
+    return tokens;
+}
+
+static double measure(const char *line, long (*lex)(const char *), long *tokens) {
+    long iterations = 0;
+    long total = 0;
+    double start = now_seconds();
+    double elapsed;
+    do {
+        for (int i = 0; i < 64; ++i) total += lex(line);
+        iterations += 64;
+        elapsed = now_seconds() - start;
+    } while (elapsed < TARGET_SECONDS);
+
+    *tokens = total / iterations;
+    return strlen(line) * (double)iterations / elapsed;
+}
+
+/* Speedups are against the original per-byte loop, which is also printed
+ * as impl=original. */
+static void run_case(const char *name, const char *line) {
+    size_t bytes = strlen(line);
+    long tokens;
+    double baseline = measure(line, original_lex_line, &tokens);
+    printf("scan case=%s impl=original bytes=%zu tokens=%ld bytes_per_sec=%.0f speedup_vs_original=1.00\n",
+            name, bytes, tokens, baseline);
+
+    for (ScanImpl impl = SCAN_SCALAR; impl <= SCAN_AVX2; ++impl) {
+        if (scan_select(impl)) continue;
+
+        double rate = measure(line, lex_line, &tokens);
+        printf("scan case=%s impl=%s bytes=%zu tokens=%ld bytes_per_sec=%.0f speedup_vs_original=%.2f\n",
+                name, scan_impl_name(impl), bytes, tokens, rate, rate / baseline);
+    }
+}
+
+int main(void) {
+    struct {
+        const char *name;
+        int size;
+        int min_word;
+        int max_word;
+    } cases[] = {
+        { "short_words_4k", 4096, 2, 10 },
+        { "long_args_4k", 4096, 64, 512 },
+        { "long_args_64k", 65536, 256, 4096 },
+    };
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        char *line = make_line(cases[i].size, cases[i].min_word, cases[i].max_word);
+        run_case(cases[i].name, line);
+        free(line);
+    }
+    return 0;
+}
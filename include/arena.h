@@ -0,0 +1,39 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_CHUNK_SIZE 8192
+
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;
+    size_t size;
+    size_t used;
+    char data[];
+} ArenaChunk;
+
+typedef struct {
+    ArenaChunk *head;
+    ArenaChunk *current;
+    size_t chunk_size;
+} Arena;
+
+/* A position to roll the arena back to, for scratch allocations that are
+ * released in stack order. */
+typedef struct {
+    ArenaChunk *chunk;
+    size_t used;
+} ArenaMark;
+
+void arena_init(Arena *arena);
+void arena_init_size(Arena *arena, size_t chunk_size);
+void *arena_alloc(Arena *arena, size_t size);
+char *arena_strndup(Arena *arena, const char *str, size_t length);
+char *arena_strdup(Arena *arena, const char *str);
+size_t arena_footprint(const Arena *arena);
+ArenaMark arena_mark(const Arena *arena);
+void arena_restore(Arena *arena, ArenaMark mark);
+void arena_reset(Arena *arena);
+void arena_free(Arena *arena);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef ASTCACHE_H
+#define ASTCACHE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "arena.h"
+#include "parser.h"
+#include "compile.h"
+
+#define AST_CACHE_INITIAL_BUCKETS 64
+#define AST_CACHE_DEFAULT_BUDGET (1024 * 1024)
+#define AST_CACHE_CHUNK_SIZE 512
+
+/* A command line compiled once. The program and the text it came from live
+ * in the entry's own arena and are never modified once cached. optimized
+ * is part of the key: a line optimized under set -o optimize is a
+ * different entry from the same line compiled as written. */
+typedef struct AstCacheEntry {
+    struct AstCacheEntry *next;
+    struct AstCacheEntry *newer;
+    struct AstCacheEntry *older;
+    unsigned long hash;
+    char *text;
+    size_t length;
+    bool optimized;
+    Program *program;
+    size_t bytes;
+    Arena arena;
+} AstCacheEntry;
+
+Program *ast_cache_lookup(const char *text, size_t length, bool optimized);
+Program *ast_cache_insert(const char *text, size_t length, bool optimized, ASTNode *ast);
+void ast_cache_set_budget(size_t bytes);
+void ast_cache_clear(void);
+void ast_cache_print(void);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+typedef int (*BuiltinFunc)(char **args);
+
+typedef struct {
+    const char *name;
+    BuiltinFunc func;
+} Builtin;
+
+const Builtin *find_builtin(const char *name);
+
+int builtin_bg(char **args);
+int builtin_break(char **args);
+int builtin_cache(char **args);
+int builtin_cat(char **args);
+int builtin_cd(char **args);
+int builtin_continue(char **args);
+int builtin_echo(char **args);
+int builtin_exit(char **args);
+int builtin_export(char **args);
+int builtin_false(char **args);
+int builtin_fg(char **args);
+int builtin_hash(char **args);
+int builtin_jobs(char **args);
+int builtin_kill(char **args);
+int builtin_printf(char **args);
+int builtin_pwd(char **args);
+int builtin_read(char **args);
+int builtin_return(char **args);
+int builtin_set(char **args);
+int builtin_tee(char **args);
+int builtin_test(char **args);
+int builtin_true(char **args);
+int builtin_unset(char **args);
+int builtin_wait(char **args);
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef COMPILE_H
+#define COMPILE_H
+
+#include "arena.h"
+#include "parser.h"
+
+/* Instructions of a compiled command line. The interpreter keeps the last
+ * status in shell_last_status. Operands are jump targets or offsets into the
+ * program's pool, where SPAWN, PIPE, BG, EXEC, FOR_ENTER and GUARD find a
+ * packed node and WAIT the pipeline whose stages were started. */
+typedef enum {
+    OP_SPAWN,           /* runs a simple command: function, builtin or program */
+    OP_PIPE,            /* starts one pipeline stage; flags PIPE_FIRST, PIPE_LAST */
+    OP_WAIT,            /* waits for the stages started since PIPE_FIRST */
+    OP_BG,              /* submits a background job */
+    OP_EXEC,            /* walks a tree with execute_ast (see below) */
+    OP_JUMP,
+    OP_JUMP_IF_FAIL,
+    OP_JUMP_IF_OK,
+    OP_STATUS,          /* sets the status to the operand */
+    OP_LOOP_ENTER,      /* opens a while or until loop */
+    OP_FOR_ENTER,       /* opens a for loop over the expanded words */
+    OP_FOR_NEXT,        /* binds the next word, or jumps out when there is none */
+    OP_LOOP_TEST,       /* after the condition; flags LOOP_UNTIL */
+    OP_LOOP_NEXT,       /* after the body: goes round again or jumps out */
+    OP_LOOP_EXIT,       /* closes the loop with the status of its last body */
+    OP_GUARD            /* skips the next instruction unless a function shadows a name */
+} OpCode;
+
+#define PIPE_FIRST 1
+#define PIPE_LAST 2
+#define LOOP_UNTIL 1
+
+/* unwind is where to go when a command leaves a break, continue or return
+ * pending, or was interrupted: the end of the enclosing loop's condition or
+ * body, or the end of the program. */
+typedef struct {
+    unsigned char op;
+    unsigned char flags;
+    int operand;
+    int unwind;
+} Instruction;
+
+/* A program is one block: this header, the pool of packed nodes with their
+ * argument vectors and redirection targets, then the code. It does not
+ * point into the tree it was compiled from. */
+typedef struct {
+    Instruction *code;
+    int length;
+    char *pool;
+    size_t pool_size;
+    int max_loops;
+    int max_stages;
+} Program;
+
+#define PROGRAM_NODE(program, offset) ((ASTNode *)((program)->pool + (offset)))
+
+/* Lowers a tree into a program allocated from arena; NULL for an empty
+ * tree. Commands, pipelines, background jobs, && and ||, lists, groups,
+ * if and the loops become instructions. These stay with the tree-walker,
+ * execute_node, through OP_EXEC:
+ * - subshells, which fork a shell to run their body;
+ * - time, which brackets its pipeline with timing;
+ * - function definitions, whose bodies are compiled when defined;
+ * - compounds with redirections, which apply them around the whole body.
+ * Pipeline stages and background jobs that fork a shell walk their tree in
+ * the child, and so do command and process substitutions. compile_tree
+ * wraps the whole tree in one EXEC; set +o compile uses it so that the
+ * tests can run every script both ways. */
+Program *compile_ast(Arena *arena, ASTNode *ast);
+Program *compile_tree(Arena *arena, ASTNode *ast);
+void print_program(const Program *program);
+
+#endif
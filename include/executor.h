@@ -1,15 +1,74 @@
 #ifndef EXECUTOR_H
 #define EXECUTOR_H
 
+#include <sys/types.h>
+#include <signal.h>
+#include <stdbool.h>
 #include "parser.h"
 #include "lexer.h"
+#include "builtins.h"
+#include "input.h"
+#include "compile.h"
+#include "variables.h"
 
-#define MAX_COMMAND_LENGTH 1024
+typedef struct {
+    bool pipefail;
+    bool optimize;
+    bool astdebug;
+    bool noglob;
+    bool timing;
+    bool compile;
+    int max_jobs;
+} ShellOptions;
+
+typedef enum {
+    CONTROL_NONE,
+    CONTROL_BREAK,
+    CONTROL_CONTINUE,
+    CONTROL_RETURN
+} ControlFlow;
+
+/* Pending break/continue/return, raised by the builtins and consumed by the
+ * enclosing loop or function call. levels counts loops still to leave. */
+typedef struct {
+    ControlFlow flow;
+    int levels;
+    int loop_depth;
+    int function_depth;
+} ControlState;
+
+/* $0 and $1... owned is set when 'set --' allocated values, which are
+ * then freed once they are replaced. */
+typedef struct {
+    char *name;
+    char **values;
+    int count;
+    bool owned;
+} PositionalParams;
+
+extern ShellOptions shell_options;
+extern ControlState shell_control;
+extern PositionalParams shell_params;
+extern int shell_last_status;
+extern bool shell_interactive;
+extern pid_t shell_pid;
+extern volatile sig_atomic_t shell_interrupted;
 
-void execute_cd(ASTNode *node);
 void execute_exit(int status);
+int wait_status(int status);
+void give_terminal(pid_t pgid);
+void positional_free(void);
+int spawn_command(ASTNode *node, int in_fd, int out_fd, pid_t pgid, pid_t *pid);
 int execute_command(ASTNode *node);
+int execute_external(char **args);
+int execute_builtin(const Builtin *builtin, ASTNode *node);
+int execute_pipeline(ASTNode *node);
+pid_t launch_background(ASTNode *node, const char *cwd, const VarSnapshot *vars);
+ASTNode *background_copy(Arena *arena, ASTNode *node, bool *fixed);
 int execute_ast(ASTNode *node);
-void shell_loop();
+int execute_program(const Program *program);
+char *execute_capture(Arena *arena, const char *text, size_t length, size_t *captured);
+char *execute_process(Arena *arena, const char *text, size_t length, bool reading);
+int shell_loop(Input *input);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,17 @@
+#ifndef EXPAND_H
+#define EXPAND_H
+
+#include "arena.h"
+#include "parser.h"
+
+/* Word expansion, done when a command runs: command and process
+ * substitution, field splitting of unquoted substitution results and quote
+ * removal. Results live in arena. An expansion error is reported and
+ * makes the result NULL. */
+char **expand_words(Arena *arena, char **words);
+char *expand_word(Arena *arena, const char *word);
+char *expand_here(Arena *arena, const char *text);
+ASTNode *expand_node(Arena *arena, ASTNode *node);
+bool expand_is_pure(ASTNode *node);
+
+#endif
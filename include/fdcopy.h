@@ -0,0 +1,19 @@
+#ifndef FDCOPY_H
+#define FDCOPY_H
+
+#include <sys/types.h>
+
+#define FD_COPY_CHUNK (1 << 20)
+#define FD_COPY_BUFFER 65536
+
+/* Moves data between descriptors without passing it through user space
+ * when the kernel allows: splice when either side is a pipe,
+ * copy_file_range between regular files and sendfile from a regular file.
+ * Anything else falls back to a read/write loop. Both functions return -1
+ * with errno set on failure. */
+ssize_t fd_copy(int in, int out);
+ssize_t fd_tee(int in, const int *outs, int count);
+void fd_grow_pipe(int fd);
+int fd_from_text(const char *text, size_t length);
+
+#endif
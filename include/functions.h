@@ -0,0 +1,30 @@
+#ifndef FUNCTIONS_H
+#define FUNCTIONS_H
+
+#include <stdbool.h>
+#include "arena.h"
+#include "parser.h"
+#include "compile.h"
+
+#define FUNCTION_INITIAL_BUCKETS 32
+#define FUNCTION_CHUNK_SIZE 1024
+
+/* A shell function owns its body, compiled. A definition replaced while it
+ * is running stays alive until its last call returns. */
+typedef struct Function {
+    struct Function *next;
+    unsigned long hash;
+    char *name;
+    Program *body;
+    Arena arena;
+    int active;
+    bool stale;
+} Function;
+
+Function *function_find(const char *name);
+void function_define(const char *name, ASTNode *body);
+bool function_unset(const char *name);
+void function_retain(Function *function);
+void function_release(Function *function);
+
+#endif
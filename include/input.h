@@ -0,0 +1,38 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/* A source of shell input. Scripts and regular files on stdin are mapped
+ * whole; pipes and terminals are read in chunks into a buffer that grows to
+ * hold the longest line. A stdin that cannot be mapped is shared with the
+ * commands the shell runs, so unless it is a terminal no more than the
+ * next line is taken from it (whole_lines); peek is the scratch pipe that
+ * looks ahead in a piped stdin. */
+typedef struct {
+    const char *data;
+    size_t length;
+    size_t position;
+    char *buffer;
+    size_t capacity;
+    size_t start;
+    size_t end;
+    int fd;
+    bool mapped;
+    bool shared_offset;
+    bool whole_lines;
+    int peek[2];
+    bool eof;
+} Input;
+
+bool input_open_file(Input *input, const char *path);
+void input_open_string(Input *input, const char *text);
+void input_open_fd(Input *input, int fd);
+bool input_read_line(Input *input, const char **line, size_t *length);
+void input_release(Input *input);
+void input_reclaim(Input *input);
+void input_close(Input *input);
+
+#endif
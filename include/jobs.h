@@ -0,0 +1,68 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stdbool.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include "parser.h"
+#include "variables.h"
+
+typedef enum {
+    JOB_QUEUED,
+    JOB_RUNNING,
+    JOB_STOPPED,
+    JOB_DONE
+} JobState;
+
+typedef struct {
+    pid_t pid;
+    int status;
+    bool stopped;
+    bool done;
+} JobProcess;
+
+/* Fields written by the SIGCHLD handler (state, the process array, end and
+ * usage) are only read by the rest of the shell with SIGCHLD blocked.
+ * A queued job is not forked until a slot frees up. Until then it owns a
+ * copy of its tree in arena, expanded when it is a simple command, with
+ * the directory and, for anything else, the variables it was submitted
+ * with. */
+typedef struct {
+    int id;
+    pid_t pgid;
+    volatile sig_atomic_t state;
+    JobProcess *procs;
+    int proc_count;
+    char *command;
+    struct timespec start;
+    struct timespec end;
+    struct rusage usage;
+    bool notified;
+    bool timed;
+    bool batched;
+    unsigned long sequence;
+    ASTNode *node;
+    Arena arena;
+    char *cwd;
+    VarSnapshot vars;
+    bool has_vars;
+} Job;
+
+void jobs_init(void);
+void jobs_block(sigset_t *saved);
+void jobs_unblock(const sigset_t *saved);
+void jobs_reap(void);
+void jobs_clear(void);
+Job *jobs_add(pid_t pgid, const pid_t *pids, int count, ASTNode *node, JobState state);
+Job *jobs_submit(ASTNode *node);
+void jobs_schedule(void);
+void jobs_drain(void);
+int jobs_limit(void);
+bool jobs_reaped_status(pid_t pid, int *status);
+Job *jobs_find(int id);
+void jobs_notify(bool print);
+pid_t jobs_last_pid(void);
+
+#endif
@@ -1,39 +1,67 @@
 #ifndef LEXER_H
 #define LEXER_H
 
+#include <stdbool.h>
+
 typedef enum {
     TOKEN_COMMAND,
     TOKEN_PIPE,
     TOKEN_INPUT_REDIR,
     TOKEN_OUTPUT_REDIR,
     TOKEN_APPEND_REDIR,
+    TOKEN_HEREDOC,
+    TOKEN_HERESTRING,
+    TOKEN_HEREDOC_BODY,
     TOKEN_AND,
     TOKEN_OR,
     TOKEN_SEMICOLON,
     TOKEN_BACKGROUND,
     TOKEN_LPAREN,
     TOKEN_RPAREN,
-    TOKEN_EOF
+    TOKEN_NEWLINE,
+    TOKEN_EOF,
+    TOKEN_ERROR
 } TokenType;
 
+typedef enum {
+    LEX_OK,
+    LEX_UNCLOSED_QUOTE,
+    LEX_UNCLOSED_SUBSTITUTION,
+    LEX_UNBALANCED_PAREN,
+    LEX_UNCLOSED_HEREDOC,
+    LEX_UNKNOWN_SYMBOL
+} LexErrorType;
+
+typedef struct {
+    LexErrorType type;
+    int position;
+} LexError;
+
 typedef struct {
     TokenType type;
-    char *value;
+    int offset;
+    int length;
 } Token;
 
 typedef struct {
     const char *input;
     int position;
     int length;
+    int depth;
+    int paren_position;
+    LexError error;
 } Lexer;
 
-Lexer *lexer_init(const char *input);
-void free_lexer(Lexer *lexer);
+void lexer_init(Lexer *lexer, const char *input);
 void skip_whitespace(Lexer *lexer);
-char *lexer_read_word(Lexer *lexer);
-char *lexer_read_quotation(Lexer *lexer, char quote);
-Token *lexer_next_token(Lexer *lexer);
-void free_token(Token *token);
+void lexer_read_word(Lexer *lexer, Token *token);
+bool lexer_read_quotation(Lexer *lexer, char quote);
+int lexer_substitution_end(const char *input, int position, int length);
+int lexer_backquote_end(const char *input, int position, int length);
+int lexer_brace_end(const char *input, int position, int length);
+bool lexer_read_heredoc(Lexer *lexer, const char *delimiter, bool strip_tabs, Token *body);
+Token lexer_next_token(Lexer *lexer);
+const char *lex_error_message(LexErrorType type);
 void test_lexer(const char *input);
 
 #endif
\ No newline at end of file
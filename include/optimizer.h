@@ -0,0 +1,15 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "arena.h"
+#include "parser.h"
+
+/* Rewrites a freshly parsed tree to save processes: cat FILE | CMD becomes
+ * CMD < FILE, subshells around external commands are dropped, true && and
+ * false || are folded, and nested sequences are flattened into one
+ * NODE_SEQUENCE with children. Each rewrite that assumes a name is not a
+ * shell function sits in a NODE_GUARD that checks it when it runs. New
+ * nodes come from arena. */
+ASTNode *optimize_ast(Arena *arena, ASTNode *node);
+
+#endif
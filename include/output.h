@@ -0,0 +1,30 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stddef.h>
+
+#define OUTPUT_BUFFER_SIZE 8192
+#define OUTPUT_MAX_FD 10
+
+/* The shell's own output, used by builtins in place of stdio. Each
+ * descriptor below OUTPUT_MAX_FD has a buffer; only one of them holds data
+ * at a time, so writes to different descriptors keep their order. A write
+ * that does not fit goes out together with the buffer in one writev.
+ * Terminals are flushed at every newline and stderr after every call.
+ * Everything else waits for output_flush_all, which has to run before the
+ * shell forks, spawns, moves a descriptor with dup2, reads input or
+ * exits. */
+void output_write(int fd, const char *data, size_t length);
+void output_puts(int fd, const char *text);
+void output_putc(int fd, char c);
+void output_printf(int fd, const char *format, ...) __attribute__((format(printf, 2, 3)));
+void output_perror(const char *prefix);
+int output_flush(int fd);
+void output_flush_all(void);
+
+/* Collects what is written to fd in memory until output_capture_end, which
+ * hands over the malloc'd text. Captures do not nest. */
+void output_capture_begin(int fd);
+void output_capture_end(int fd, char **text, size_t *length);
+
+#endif
@@ -3,18 +3,24 @@
 
 #include <stdbool.h>
 #include "lexer.h"
+#include "arena.h"
 
 typedef struct {
+    Arena *arena;
+    const char *input;
     Token *tokens;
     int length;
+    int capacity;
     int position;
+    LexError error;
+    const char *parse_error;
+    bool incomplete;
 } TokenArray;
 
-bool has_unclosed_quotes(const char *str);
-bool has_imbalanced_brackets(const char *str);
-
-TokenArray *tokenize(const char *input);
-void free_token_array(TokenArray *array);
+TokenArray *tokenize(Arena *arena, const char *input);
+void print_lex_error(TokenArray *array);
+void print_parse_error(TokenArray *array);
+char *token_text(TokenArray *array, Token *token);
 Token *peek_token(TokenArray *array);
 Token *next_token(TokenArray *array);
 
@@ -25,26 +31,66 @@ typedef enum {
     NODE_OR,
     NODE_SEQUENCE,
     NODE_BACKGROUND,
-    NODE_SUBSHELL
+    NODE_SUBSHELL,
+    NODE_GROUP,
+    NODE_IF,
+    NODE_WHILE,
+    NODE_UNTIL,
+    NODE_FOR,
+    NODE_FUNCTION,
+    NODE_TIME,
+    NODE_GUARD
 } NodeType;
 
+/* Standard input given as text instead of input_file: a here-document body
+ * used as written (quoted delimiter, or already expanded), one whose
+ * parameters, substitutions and backslashes still have to be expanded, or a
+ * here-string word, which is read with a newline added. */
+typedef enum {
+    HERE_NONE,
+    HERE_LITERAL,
+    HERE_DOCUMENT,
+    HERE_STRING
+} HereType;
+
+/* Compound nodes: GROUP runs left; IF has children condition, then-list
+ * and an optional else-list (an elif is a nested IF); WHILE and UNTIL run
+ * body right against condition left; FOR binds name to each of args (NULL
+ * means the positional parameters) around body left; FUNCTION defines name
+ * with body left; TIME reports the resources its pipeline left used (left
+ * is NULL for a bare time). GUARD is left by the optimizer: it runs left,
+ * the rewritten tree, unless one of the command names in args has since
+ * become a shell function, and then right, the tree as written. Words in
+ * args and the file names are kept as written;
+ * expand marks the nodes where some of them need quote removal or
+ * substitution before use. A command's first assignments args are
+ * NAME=value words. */
+
 typedef struct ASTNode {
     NodeType type;
     struct ASTNode *left;
     struct ASTNode *right;
+    struct ASTNode **children;
+    int child_count;
     char **args;
     char *input_file;
+    char *here_text;
+    HereType here;
     char *output_file;
     int append;
+    char *name;
+    bool expand;
+    int assignments;
 } ASTNode;
 
-ASTNode *create_node(NodeType type, ASTNode *left, ASTNode *right);
+ASTNode *create_node(Arena *arena, NodeType type, ASTNode *left, ASTNode *right);
 ASTNode *parse_command(TokenArray *array);
 ASTNode *parse_pipeline(TokenArray *array);
 ASTNode *parse_and_or(TokenArray *array);
 ASTNode *parse_sequence_background(TokenArray *array);
 ASTNode *parse_expression(TokenArray *array);
-void free_ast(ASTNode *node);
+ASTNode *ast_clone(Arena *arena, ASTNode *node);
+char *ast_to_string(ASTNode *node);
 void print_ast(ASTNode *node, int level);
 void test_parser(const char *input);
 
@@ -0,0 +1,20 @@
+#ifndef PATHCACHE_H
+#define PATHCACHE_H
+
+#define PATH_CACHE_INITIAL_BUCKETS 64
+
+typedef struct PathEntry {
+    struct PathEntry *next;
+    unsigned long hash;
+    char *name;
+    char *path;
+    int hits;
+} PathEntry;
+
+const char *path_lookup(const char *name);
+void path_cache_forget(const char *name);
+void path_cache_clear(void);
+void path_cache_invalidate(void);
+void path_cache_print(void);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef PATHGLOB_H
+#define PATHGLOB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <time.h>
+#include "arena.h"
+
+#define GLOB_CACHE_SLOTS 64
+#define GLOB_CACHE_BUDGET (64 << 20)
+#define GLOB_READ_BUFFER 65536
+
+/* One directory entry: an offset into the listing's name buffer and the
+ * d_type getdents64 reported. */
+typedef struct {
+    uint32_t name;
+    unsigned char type;
+} GlobEntry;
+
+/* A directory's names, sorted, packed into one buffer. Listings are cached
+ * by device and inode and reused while the directory's mtime and ctime are
+ * unchanged. */
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    struct timespec ctime;
+    char *names;
+    GlobEntry *entries;
+    int count;
+    size_t bytes;
+    unsigned long used;
+    int pinned;
+    bool cached;
+} DirListing;
+
+/* Expands pattern, where a backslash quotes the next character. Returns the
+ * number of matches, stored sorted in *matches; 0 means no match or no
+ * unquoted '*', '?' or '[...]' at all. '**' as a whole component matches
+ * any number of directories. */
+int path_glob(Arena *arena, const char *pattern, char ***matches);
+
+#endif
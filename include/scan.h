@@ -0,0 +1,27 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#define SCAN_SPACE    0x01
+#define SCAN_OPERATOR 0x02
+#define SCAN_QUOTE    0x04
+#define SCAN_EXPAND   0x08
+#define SCAN_GLOB     0x10
+
+/* Classes that end an unquoted run of word characters. */
+#define SCAN_WORD_END (SCAN_SPACE | SCAN_OPERATOR | SCAN_QUOTE | SCAN_EXPAND)
+
+typedef enum {
+    SCAN_SCALAR,
+    SCAN_SSE2,
+    SCAN_AVX2
+} ScanImpl;
+
+extern const unsigned char scan_class[256];
+
+int scan_word_end(const char *input, int position, int length);
+int scan_skip_space(const char *input, int position, int length);
+ScanImpl scan_best(void);
+int scan_select(ScanImpl impl);
+const char *scan_impl_name(ScanImpl impl);
+
+#endif
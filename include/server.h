@@ -0,0 +1,17 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#define SERVER_DEFAULT_WORKERS 4
+#define SERVER_BACKLOG 128
+
+/* A request is the client's stdin, stdout and stderr, passed with
+ * SCM_RIGHTS, and a payload of NUL-terminated records, each tagged by its
+ * first byte: 'C' the working directory, 'E' one NAME=value of the
+ * client's environment, 'X' the command text. The client then shuts down
+ * its side, and the worker answers with one line once the command is done:
+ * "status=N wall_ms=... user_ms=... sys_ms=... maxrss_kb=... nvcsw=...
+ * nivcsw=...". */
+int server_run(const char *path, int workers);
+int client_run(const char *path, const char *command);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <time.h>
+#include <sys/resource.h>
+
+#define TIMING_LOG_VARIABLE "MYSHELL_TIMING_LOG"
+
+/* Measures the resources used between timing_start and timing_stop: the
+ * shell's own plus those of every foreground child reaped meanwhile.
+ * Timings nest. */
+typedef struct {
+    struct timespec start;
+    struct rusage self;
+    struct rusage children;
+    long outer_maxrss;
+} Timing;
+
+/* Times in seconds; maxrss in kilobytes. */
+typedef struct {
+    double wall;
+    double user;
+    double sys;
+    long maxrss;
+    long nvcsw;
+    long nivcsw;
+} TimingSample;
+
+void timing_start(Timing *timing);
+void timing_stop(Timing *timing, TimingSample *sample);
+void timing_child(const struct rusage *usage);
+void timing_sample(TimingSample *sample, const struct timespec *start, const struct timespec *end,
+        const struct rusage *usage);
+void timing_record(const char *kind, int index, const char *command, int status, const TimingSample *sample);
+void timing_print(const TimingSample *sample);
+
+#endif
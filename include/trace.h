@@ -0,0 +1,29 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TRACE_VARIABLE "MYSHELL_TRACE"
+#define TRACE_DETAIL_MAX 160
+
+/* Phase tracing, turned on at startup by naming a file in MYSHELL_TRACE.
+ * Each phase becomes one Chrome trace event ("ph":"X") appended to the
+ * file, which holds a JSON array left open so that forked shells can keep
+ * appending; trace viewers accept it without the closing ']'. Off, a phase
+ * costs one branch; building with -DSHELL_NO_TRACE removes even that. */
+extern bool trace_enabled;
+
+void trace_init(void);
+uint64_t trace_now(void);
+void trace_event(const char *name, uint64_t start, const char *detail);
+
+#ifdef SHELL_NO_TRACE
+#define TRACE_BEGIN(span) ((void)0)
+#define TRACE_END(span, name, detail) ((void)0)
+#else
+#define TRACE_BEGIN(span) uint64_t span = trace_enabled ? trace_now() : 0
+#define TRACE_END(span, name, detail) do { if (trace_enabled) trace_event(name, span, detail); } while (0)
+#endif
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef VARIABLES_H
+#define VARIABLES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "arena.h"
+
+#define VAR_INITIAL_SLOTS 128
+
+/* One slot of the open-addressing table. Names are interned and a slot
+ * keeps its name after an unset, with entry NULL, so probing never needs
+ * tombstones. entry is "NAME=value", ready to go into the environment. */
+typedef struct {
+    const char *name;
+    unsigned int hash;
+    char *entry;
+    const char *value;
+    bool exported;
+} Variable;
+
+/* Every set variable as it was at one moment, for var_restore. */
+typedef struct {
+    char **entries;
+    bool *exported;
+    int count;
+} VarSnapshot;
+
+void vars_init(char **envp);
+const char *var_get(const char *name);
+const char *var_lookup(const char *name, size_t length);
+bool var_is_exported(const char *name);
+void var_set(const char *name, const char *value, bool export);
+void var_set_exported(const char *name, bool exported);
+void var_unset(const char *name);
+char **var_environ(void);
+void var_snapshot(Arena *arena, VarSnapshot *snapshot);
+void var_restore(const VarSnapshot *snapshot);
+
+#endif
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdalign.h>
+#include "arena.h"
+
+#define ARENA_ALIGN alignof(max_align_t)
+
+static ArenaChunk *arena_new_chunk(size_t size) {
+    ArenaChunk *chunk = malloc(sizeof(ArenaChunk) + size);
+    if (!chunk) {
+        perror("arena allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+void arena_init(Arena *arena) {
+    arena_init_size(arena, ARENA_CHUNK_SIZE);
+}
+
+/* Small arenas suit many long-lived objects, each owning its memory. */
+void arena_init_size(Arena *arena, size_t chunk_size) {
+    arena->chunk_size = chunk_size;
+    arena->head = arena_new_chunk(chunk_size);
+    arena->current = arena->head;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    ArenaChunk *chunk = arena->current;
+    while (chunk->used + size > chunk->size) {
+        if (chunk->next && chunk->next->size >= size) {
+            chunk = chunk->next;
+            chunk->used = 0;
+        }
+        else {
+            ArenaChunk *fresh = arena_new_chunk(size > arena->chunk_size ? size : arena->chunk_size);
+            fresh->next = chunk->next;
+            chunk->next = fresh;
+            chunk = fresh;
+        }
+    }
+    arena->current = chunk;
+
+    void *ptr = chunk->data + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+char *arena_strndup(Arena *arena, const char *str, size_t length) {
+    char *copy = arena_alloc(arena, length + 1);
+    memcpy(copy, str, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+char *arena_strdup(Arena *arena, const char *str) {
+    return arena_strndup(arena, str, strlen(str));
+}
+
+/* Bytes held from malloc, including chunk headers. */
+size_t arena_footprint(const Arena *arena) {
+    size_t total = 0;
+    for (ArenaChunk *chunk = arena->head; chunk; chunk = chunk->next) {
+        total += sizeof(ArenaChunk) + chunk->size;
+    }
+    return total;
+}
+
+ArenaMark arena_mark(const Arena *arena) {
+    ArenaMark mark = { arena->current, arena->current->used };
+    return mark;
+}
+
+/* Chunks after the mark stay linked and are reused by later allocations. */
+void arena_restore(Arena *arena, ArenaMark mark) {
+    arena->current = mark.chunk;
+    mark.chunk->used = mark.used;
+}
+
+void arena_reset(Arena *arena) {
+    arena->current = arena->head;
+    arena->head->used = 0;
+}
+
+void arena_free(Arena *arena) {
+    ArenaChunk *chunk = arena->head;
+    while (chunk) {
+        ArenaChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->head = NULL;
+    arena->current = NULL;
+}
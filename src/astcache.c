@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "astcache.h"
+#include "output.h"
+
+static AstCacheEntry **buckets = NULL;
+static int bucket_count = 0;
+static int entry_count = 0;
+static AstCacheEntry *newest = NULL;
+static AstCacheEntry *oldest = NULL;
+static size_t used_bytes = 0;
+static size_t budget = AST_CACHE_DEFAULT_BUDGET;
+static unsigned long hits = 0;
+static unsigned long misses = 0;
+static unsigned long evictions = 0;
+static AstCacheEntry *in_use = NULL;
+static AstCacheEntry *retired = NULL;
+
+/* FNV-1a over the whole command text, then the optimize flag. */
+static unsigned long hash_text(const char *text, size_t length, bool optimized) {
+    unsigned long hash = 14695981039346656037UL;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= (unsigned char)text[i];
+        hash *= 1099511628211UL;
+    }
+    return (hash ^ optimized) * 1099511628211UL;
+}
+
+static void ast_cache_grow(void) {
+    int new_count = bucket_count ? bucket_count * 2 : AST_CACHE_INITIAL_BUCKETS;
+    AstCacheEntry **new_buckets = calloc(new_count, sizeof(AstCacheEntry *));
+
+    for (int i = 0; i < bucket_count; ++i) {
+        AstCacheEntry *entry = buckets[i];
+        while (entry) {
+            AstCacheEntry *next = entry->next;
+            int index = entry->hash & (new_count - 1);
+            entry->next = new_buckets[index];
+            new_buckets[index] = entry;
+            entry = next;
+        }
+    }
+
+    free(buckets);
+    buckets = new_buckets;
+    bucket_count = new_count;
+}
+
+static void lru_unlink(AstCacheEntry *entry) {
+    if (entry->newer) entry->newer->older = entry->older;
+    else newest = entry->older;
+    if (entry->older) entry->older->newer = entry->newer;
+    else oldest = entry->newer;
+    entry->newer = entry->older = NULL;
+}
+
+static void lru_push(AstCacheEntry *entry) {
+    entry->older = newest;
+    entry->newer = NULL;
+    if (newest) newest->newer = entry;
+    newest = entry;
+    if (!oldest) oldest = entry;
+}
+
+static void ast_cache_remove(AstCacheEntry *entry) {
+    AstCacheEntry **link = &buckets[entry->hash & (bucket_count - 1)];
+    while (*link != entry) link = &(*link)->next;
+    *link = entry->next;
+
+    lru_unlink(entry);
+    used_bytes -= entry->bytes;
+    entry_count--;
+
+    /* The program last handed out may still be running (say, 'cache -r' on a
+     * cached line); it is freed on the next lookup instead. */
+    if (entry == in_use) {
+        retired = entry;
+        return;
+    }
+    arena_free(&entry->arena);
+    free(entry);
+}
+
+static void release_retired(void) {
+    if (retired) {
+        arena_free(&retired->arena);
+        free(retired);
+    }
+    retired = NULL;
+    in_use = NULL;
+}
+
+static void ast_cache_trim(void) {
+    while (oldest && used_bytes > budget) {
+        ast_cache_remove(oldest);
+        evictions++;
+    }
+}
+
+Program *ast_cache_lookup(const char *text, size_t length, bool optimized) {
+    release_retired();
+
+    unsigned long hash = hash_text(text, length, optimized);
+    if (bucket_count) {
+        for (AstCacheEntry *entry = buckets[hash & (bucket_count - 1)]; entry; entry = entry->next) {
+            if (entry->hash == hash && entry->length == length && entry->optimized == optimized &&
+                    !memcmp(entry->text, text, length)) {
+                lru_unlink(entry);
+                lru_push(entry);
+                in_use = entry;
+                hits++;
+                return entry->program;
+            }
+        }
+    }
+    misses++;
+    return NULL;
+}
+
+/* Caches ast for text, optimized or not, compiled into the entry's arena,
+ * evicting the least recently used entries to stay within the budget.
+ * Returns the cached program, or NULL when nothing is cached. */
+Program *ast_cache_insert(const char *text, size_t length, bool optimized, ASTNode *ast) {
+    if (!ast || !budget) return NULL;
+
+    if (entry_count + 1 > bucket_count * 3 / 4) ast_cache_grow();
+
+    AstCacheEntry *entry = malloc(sizeof(AstCacheEntry));
+    arena_init_size(&entry->arena, AST_CACHE_CHUNK_SIZE);
+    entry->hash = hash_text(text, length, optimized);
+    entry->text = arena_strndup(&entry->arena, text, length);
+    entry->length = length;
+    entry->optimized = optimized;
+    entry->program = compile_ast(&entry->arena, ast);
+    entry->bytes = sizeof(AstCacheEntry) + arena_footprint(&entry->arena);
+
+    int index = entry->hash & (bucket_count - 1);
+    entry->next = buckets[index];
+    buckets[index] = entry;
+    lru_push(entry);
+    used_bytes += entry->bytes;
+    entry_count++;
+
+    /* The caller runs the program it gets back, even if it is evicted. */
+    in_use = entry;
+    ast_cache_trim();
+    return entry->program;
+}
+
+void ast_cache_set_budget(size_t bytes) {
+    budget = bytes;
+    ast_cache_trim();
+}
+
+void ast_cache_clear(void) {
+    while (oldest) ast_cache_remove(oldest);
+}
+
+void ast_cache_print(void) {
+    unsigned long lookups = hits + misses;
+    output_printf(STDOUT_FILENO, "hits %lu misses %lu hit-rate %.1f%% evictions %lu\n", hits, misses,
+            lookups ? 100.0 * hits / lookups : 0.0, evictions);
+    output_printf(STDOUT_FILENO, "entries %d bytes %zu budget %zu\n", entry_count, used_bytes, budget);
+}
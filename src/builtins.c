@@ -0,0 +1,902 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "builtins.h"
+#include "executor.h"
+#include "pathcache.h"
+#include "jobs.h"
+#include "astcache.h"
+#include "functions.h"
+#include "fdcopy.h"
+#include "variables.h"
+#include "output.h"
+
+/* Kept sorted by name for bsearch. */
+static const Builtin builtins[] = {
+    { "[", builtin_test },
+    { "bg", builtin_bg },
+    { "break", builtin_break },
+    { "cache", builtin_cache },
+    { "cat", builtin_cat },
+    { "cd", builtin_cd },
+    { "continue", builtin_continue },
+    { "echo", builtin_echo },
+    { "exit", builtin_exit },
+    { "export", builtin_export },
+    { "false", builtin_false },
+    { "fg", builtin_fg },
+    { "hash", builtin_hash },
+    { "jobs", builtin_jobs },
+    { "kill", builtin_kill },
+    { "printf", builtin_printf },
+    { "pwd", builtin_pwd },
+    { "read", builtin_read },
+    { "return", builtin_return },
+    { "set", builtin_set },
+    { "tee", builtin_tee },
+    { "test", builtin_test },
+    { "true", builtin_true },
+    { "unset", builtin_unset },
+    { "wait", builtin_wait },
+};
+
+static int compare_builtin(const void *key, const void *element) {
+    return strcmp(key, ((const Builtin *)element)->name);
+}
+
+const Builtin *find_builtin(const char *name) {
+    return bsearch(name, builtins, sizeof(builtins) / sizeof(builtins[0]),
+            sizeof(Builtin), compare_builtin);
+}
+
+static bool is_identifier(const char *name, size_t length) {
+    if (!length || !(isalpha((unsigned char)name[0]) || name[0] == '_')) return false;
+    for (size_t i = 1; i < length; ++i) {
+        if (!(isalnum((unsigned char)name[i]) || name[i] == '_')) return false;
+    }
+    return true;
+}
+
+/* Writes one backslash escape starting at s (which points at the backslash)
+ * and returns the number of characters consumed. *stop is set by \c.
+ * Octal escapes are \0nnn for echo and %b, \nnn in printf formats. */
+static int print_escape(const char *s, bool leading_zero, bool *stop) {
+    int consumed = 2;
+    switch (s[1]) {
+        case 'a': output_putc(STDOUT_FILENO, '\a'); break;
+        case 'b': output_putc(STDOUT_FILENO, '\b'); break;
+        case 'f': output_putc(STDOUT_FILENO, '\f'); break;
+        case 'n': output_putc(STDOUT_FILENO, '\n'); break;
+        case 'r': output_putc(STDOUT_FILENO, '\r'); break;
+        case 't': output_putc(STDOUT_FILENO, '\t'); break;
+        case 'v': output_putc(STDOUT_FILENO, '\v'); break;
+        case '\\': output_putc(STDOUT_FILENO, '\\'); break;
+        case 'c': *stop = true; break;
+        case '\0': output_putc(STDOUT_FILENO, '\\'); consumed = 1; break;
+        default:
+            if (s[1] >= '0' && s[1] <= '7') {
+                const char *digits = s + 1;
+                if (leading_zero && *digits == '0') digits++;
+                int value = 0;
+                int count = 0;
+                while (count < 3 && digits[count] >= '0' && digits[count] <= '7') {
+                    value = value * 8 + (digits[count++] - '0');
+                }
+                output_putc(STDOUT_FILENO, value);
+                return (int)(digits - s) + count;
+            }
+            output_putc(STDOUT_FILENO, '\\');
+            output_putc(STDOUT_FILENO, s[1]);
+            break;
+    }
+    return consumed;
+}
+
+static bool print_escaped(const char *s) {
+    bool stop = false;
+    while (*s && !stop) {
+        if (*s == '\\') s += print_escape(s, true, &stop);
+        else output_putc(STDOUT_FILENO, *s++);
+    }
+    return stop;
+}
+
+int builtin_cd(char **args) {
+    const char *dir = args[1];
+    if (!dir) dir = var_get("HOME");
+    else if (!strcmp("-", dir)) {
+        dir = var_get("OLDPWD");
+        if (dir) output_printf(STDOUT_FILENO, "%s\n", dir);
+    }
+
+    if (!dir) {
+        output_printf(STDERR_FILENO, "cd: %s not set\n", args[1] ? "OLDPWD" : "HOME");
+        return 1;
+    }
+
+    char old_cwd[4096];
+    bool have_old = getcwd(old_cwd, sizeof(old_cwd)) != NULL;
+
+    if (chdir(dir)) {
+        output_perror("cd failed");
+        return 1;
+    }
+
+    char cwd[4096];
+    if (have_old) var_set("OLDPWD", old_cwd, false);
+    if (getcwd(cwd, sizeof(cwd))) var_set("PWD", cwd, false);
+    return 0;
+}
+
+int builtin_echo(char **args) {
+    bool newline = true;
+    bool escapes = false;
+    int i = 1;
+
+    for (; args[i] && args[i][0] == '-' && args[i][1]; ++i) {
+        if (strspn(args[i] + 1, "neE") != strlen(args[i] + 1)) break;
+        for (const char *flag = args[i] + 1; *flag; ++flag) {
+            if (*flag == 'n') newline = false;
+            else escapes = (*flag == 'e');
+        }
+    }
+
+    for (; args[i]; ++i) {
+        if (escapes) {
+            if (print_escaped(args[i])) return 0;
+        }
+        else output_puts(STDOUT_FILENO, args[i]);
+        if (args[i + 1]) output_putc(STDOUT_FILENO, ' ');
+    }
+    if (newline) output_putc(STDOUT_FILENO, '\n');
+    return 0;
+}
+
+static int loop_control(char **args, ControlFlow flow, const char *name) {
+    int levels = 1;
+    if (args[1]) {
+        char *end;
+        long value = strtol(args[1], &end, 10);
+        if (!*args[1] || *end || value < 1) {
+            output_printf(STDERR_FILENO, "%s: %s: loop count out of range\n", name, args[1]);
+            return 1;
+        }
+        levels = value > INT_MAX ? INT_MAX : (int)value;
+    }
+    if (!shell_control.loop_depth) {
+        output_printf(STDERR_FILENO, "%s: only meaningful in a 'for', 'while', or 'until' loop\n", name);
+        return 0;
+    }
+
+    shell_control.flow = flow;
+    shell_control.levels = levels < shell_control.loop_depth ? levels : shell_control.loop_depth;
+    return 0;
+}
+
+int builtin_break(char **args) {
+    return loop_control(args, CONTROL_BREAK, "break");
+}
+
+int builtin_continue(char **args) {
+    return loop_control(args, CONTROL_CONTINUE, "continue");
+}
+
+int builtin_return(char **args) {
+    if (!shell_control.function_depth) {
+        output_printf(STDERR_FILENO, "return: can only 'return' from a function\n");
+        return 1;
+    }
+
+    int status = shell_last_status;
+    if (args[1]) {
+        char *end;
+        long value = strtol(args[1], &end, 10);
+        if (!*args[1] || *end) {
+            output_printf(STDERR_FILENO, "return: %s: numeric argument required\n", args[1]);
+            value = 2;
+        }
+        status = (int)(value & 0xff);
+    }
+    shell_control.flow = CONTROL_RETURN;
+    return status;
+}
+
+int builtin_exit(char **args) {
+    int status = shell_last_status;
+    if (args[1]) {
+        char *end;
+        long value = strtol(args[1], &end, 10);
+        if (!*args[1] || *end) {
+            output_printf(STDERR_FILENO, "exit: %s: numeric argument required\n", args[1]);
+            status = 2;
+        }
+        else status = (int)value;
+    }
+    execute_exit(status & 0xff);
+    return status;
+}
+
+int builtin_export(char **args) {
+    if (!args[1] || !strcmp("-p", args[1])) {
+        for (char **env = var_environ(); *env; ++env) {
+            const char *eq = strchr(*env, '=');
+            if (!eq) continue;
+            output_printf(STDOUT_FILENO, "export %.*s=\"%s\"\n", (int)(eq - *env), *env, eq + 1);
+        }
+        return 0;
+    }
+
+    int status = 0;
+    for (int i = 1; args[i]; ++i) {
+        const char *eq = strchr(args[i], '=');
+        size_t length = eq ? (size_t)(eq - args[i]) : strlen(args[i]);
+        if (!is_identifier(args[i], length)) {
+            output_printf(STDERR_FILENO, "export: '%s': not a valid identifier\n", args[i]);
+            status = 1;
+            continue;
+        }
+        char *name = strndup(args[i], length);
+        if (eq) var_set(name, eq + 1, true);
+        else var_set_exported(name, true);
+        free(name);
+    }
+    return status;
+}
+
+int builtin_false(char **args) {
+    (void)args;
+    return 1;
+}
+
+int builtin_hash(char **args) {
+    if (!args[1]) {
+        path_cache_print();
+        return 0;
+    }
+
+    int status = 0;
+    for (int i = 1; args[i]; ++i) {
+        if (!strcmp("-r", args[i])) path_cache_clear();
+        else if (!strchr(args[i], '/') && !path_lookup(args[i])) {
+            output_printf(STDERR_FILENO, "hash: %s: not found\n", args[i]);
+            status = 1;
+        }
+    }
+    return status;
+}
+
+int builtin_cache(char **args) {
+    if (!args[1]) {
+        ast_cache_print();
+        return 0;
+    }
+
+    for (int i = 1; args[i]; ++i) {
+        if (!strcmp("-r", args[i])) ast_cache_clear();
+        else if (!strcmp("-b", args[i]) && args[i + 1]) {
+            char *end;
+            unsigned long long bytes = strtoull(args[++i], &end, 10);
+            if (*end || args[i][0] == '-') {
+                output_printf(STDERR_FILENO, "cache: -b: invalid size: %s\n", args[i]);
+                return 2;
+            }
+            ast_cache_set_budget(bytes);
+        }
+        else {
+            output_printf(STDERR_FILENO, "cache: usage: cache [-r] [-b bytes]\n");
+            return 2;
+        }
+    }
+    return 0;
+}
+
+/* The shell's SIGINT handler restarts the call it interrupts. cat and tee
+ * turn that off while they copy, so that Ctrl-C ends a read from the
+ * terminal; the copy then fails with EINTR. */
+static void copy_begin(struct sigaction *saved) {
+    struct sigaction action;
+    sigaction(SIGINT, NULL, saved);
+    action = *saved;
+    action.sa_flags &= ~SA_RESTART;
+    sigaction(SIGINT, &action, NULL);
+    output_flush_all();
+}
+
+static void copy_end(const struct sigaction *saved) {
+    sigaction(SIGINT, saved, NULL);
+}
+
+/* Copies files to stdout in the kernel. Options are left to the external
+ * cat. */
+int builtin_cat(char **args) {
+    for (int i = 1; args[i]; ++i) {
+        if (args[i][0] == '-' && args[i][1]) return execute_external(args);
+    }
+
+    struct sigaction saved;
+    copy_begin(&saved);
+    fd_grow_pipe(STDOUT_FILENO);
+
+    char *stdin_only[] = { "-", NULL };
+    char **files = args[1] ? args + 1 : stdin_only;
+    int status = 0;
+    for (int i = 0; files[i] && !shell_interrupted; ++i) {
+        bool use_stdin = !strcmp(files[i], "-");
+        int fd = use_stdin ? STDIN_FILENO : open(files[i], O_RDONLY | O_CLOEXEC);
+        if (fd == -1 || fd_copy(fd, STDOUT_FILENO) < 0) {
+            if (shell_interrupted) status = 128 + SIGINT;
+            else {
+                output_printf(STDERR_FILENO, "cat: %s: %s\n", files[i], strerror(errno));
+                status = 1;
+            }
+        }
+        if (fd != -1 && !use_stdin) close(fd);
+    }
+    copy_end(&saved);
+    return status;
+}
+
+static bool parse_printf_number(const char *value, long long *number) {
+    if (!value || !*value) {
+        *number = 0;
+        return true;
+    }
+    if (value[0] == '\'' || value[0] == '"') {
+        *number = (unsigned char)value[1];
+        return true;
+    }
+
+    char *end;
+    errno = 0;
+    *number = strtoll(value, &end, 0);
+    if (errno || *end) {
+        output_printf(STDERR_FILENO, "printf: %s: invalid number\n", value);
+        return false;
+    }
+    return true;
+}
+
+int builtin_printf(char **args) {
+    if (!args[1]) {
+        output_printf(STDERR_FILENO, "printf: usage: printf format [arguments]\n");
+        return 2;
+    }
+
+    const char *format = args[1];
+    char **arg = args + 2;
+    int status = 0;
+    bool consumed;
+
+    do {
+        consumed = false;
+        const char *p = format;
+        while (*p) {
+            if (*p == '\\') {
+                bool stop = false;
+                p += print_escape(p, false, &stop);
+                if (stop) return status;
+                continue;
+            }
+            if (*p != '%') {
+                output_putc(STDOUT_FILENO, *p++);
+                continue;
+            }
+            if (p[1] == '%') {
+                output_putc(STDOUT_FILENO, '%');
+                p += 2;
+                continue;
+            }
+
+            char spec[32];
+            size_t spec_length = 0;
+            spec[spec_length++] = *p++;
+            while (*p && strchr("-+ #0", *p) && spec_length < 8) spec[spec_length++] = *p++;
+            while (isdigit((unsigned char)*p) && spec_length < 16) spec[spec_length++] = *p++;
+            if (*p == '.') {
+                spec[spec_length++] = *p++;
+                while (isdigit((unsigned char)*p) && spec_length < 24) spec[spec_length++] = *p++;
+            }
+
+            char conversion = *p;
+            if (!conversion) {
+                output_printf(STDERR_FILENO, "printf: missing format character\n");
+                return 1;
+            }
+            p++;
+
+            const char *value = *arg;
+            if (value) {
+                arg++;
+                consumed = true;
+            }
+
+            long long number;
+            switch (conversion) {
+                case 's':
+                    spec[spec_length++] = 's';
+                    spec[spec_length] = '\0';
+                    output_printf(STDOUT_FILENO, spec, value ? value : "");
+                    break;
+                case 'b':
+                    if (value && print_escaped(value)) return status;
+                    break;
+                case 'c':
+                    if (value && *value) output_putc(STDOUT_FILENO, value[0]);
+                    break;
+                case 'd':
+                case 'i':
+                    if (!parse_printf_number(value, &number)) status = 1;
+                    memcpy(spec + spec_length, "lld", 4);
+                    output_printf(STDOUT_FILENO, spec, number);
+                    break;
+                case 'u':
+                case 'o':
+                case 'x':
+                case 'X':
+                    if (!parse_printf_number(value, &number)) status = 1;
+                    memcpy(spec + spec_length, "ll", 2);
+                    spec[spec_length + 2] = conversion;
+                    spec[spec_length + 3] = '\0';
+                    output_printf(STDOUT_FILENO, spec, (unsigned long long)number);
+                    break;
+                default:
+                    output_printf(STDERR_FILENO, "printf: %%%c: invalid directive\n", conversion);
+                    return 1;
+            }
+        }
+    } while (*arg && consumed);
+
+    return status;
+}
+
+int builtin_pwd(char **args) {
+    (void)args;
+    char cwd[4096];
+    if (!getcwd(cwd, sizeof(cwd))) {
+        output_perror("pwd failed");
+        return 1;
+    }
+    output_printf(STDOUT_FILENO, "%s\n", cwd);
+    return 0;
+}
+
+/* Reads one byte at a time so nothing past the newline is taken from a
+ * descriptor that is shared with child processes. */
+int builtin_read(char **args) {
+    bool raw = false;
+    const char *prompt = NULL;
+    int i = 1;
+
+    for (; args[i] && args[i][0] == '-' && args[i][1]; ++i) {
+        if (!strcmp("-r", args[i])) raw = true;
+        else if (!strcmp("-p", args[i]) && args[i + 1]) prompt = args[++i];
+        else if (!strcmp("--", args[i])) {
+            i++;
+            break;
+        }
+        else {
+            output_printf(STDERR_FILENO, "read: %s: invalid option\n", args[i]);
+            return 2;
+        }
+    }
+
+    char *default_names[] = { "REPLY", NULL };
+    char **names = args[i] ? args + i : default_names;
+    for (int n = 0; names[n]; ++n) {
+        if (!is_identifier(names[n], strlen(names[n]))) {
+            output_printf(STDERR_FILENO, "read: '%s': not a valid identifier\n", names[n]);
+            return 1;
+        }
+    }
+
+    output_flush_all();
+    if (prompt && isatty(STDIN_FILENO)) output_puts(STDERR_FILENO, prompt);
+
+    size_t capacity = 128;
+    size_t length = 0;
+    char *line = malloc(capacity);
+    bool *escaped = malloc(capacity);
+    bool eof = false;
+
+    while (1) {
+        char c;
+        ssize_t n = read(STDIN_FILENO, &c, 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            eof = true;
+            break;
+        }
+        if (c == '\n') break;
+
+        bool is_escaped = false;
+        if (c == '\\' && !raw) {
+            n = read(STDIN_FILENO, &c, 1);
+            if (n <= 0) {
+                eof = true;
+                break;
+            }
+            if (c == '\n') continue;
+            is_escaped = true;
+        }
+
+        if (length + 1 >= capacity) {
+            capacity *= 2;
+            line = realloc(line, capacity);
+            escaped = realloc(escaped, capacity);
+        }
+        escaped[length] = is_escaped;
+        line[length++] = c;
+    }
+    line[length] = '\0';
+
+    const char *ifs = var_get("IFS");
+    if (!ifs) ifs = " \t\n";
+
+    size_t pos = 0;
+    for (int n = 0; names[n]; ++n) {
+        while (pos < length && !escaped[pos] && strchr(ifs, line[pos]) && isspace((unsigned char)line[pos])) pos++;
+
+        size_t start = pos;
+        size_t end;
+        if (!names[n + 1]) {
+            end = length;
+            while (end > start && !escaped[end - 1] && strchr(ifs, line[end - 1]) &&
+                    isspace((unsigned char)line[end - 1])) end--;
+        }
+        else {
+            while (pos < length && (escaped[pos] || !strchr(ifs, line[pos]))) pos++;
+            end = pos;
+            if (pos < length) pos++;
+        }
+
+        char *value = strndup(line + start, end - start);
+        var_set(names[n], value, false);
+        free(value);
+    }
+
+    free(line);
+    free(escaped);
+    return eof ? 1 : 0;
+}
+
+static const struct {
+    const char *name;
+    bool *value;
+} set_options[] = {
+    { "astdebug", &shell_options.astdebug },
+    { "compile", &shell_options.compile },
+    { "noglob", &shell_options.noglob },
+    { "optimize", &shell_options.optimize },
+    { "pipefail", &shell_options.pipefail },
+    { "timing", &shell_options.timing },
+};
+
+#define SET_OPTION_COUNT (int)(sizeof(set_options) / sizeof(set_options[0]))
+
+static bool set_option(const char *name, bool enable) {
+    for (int i = 0; i < SET_OPTION_COUNT; ++i) {
+        if (!strcmp(set_options[i].name, name)) {
+            *set_options[i].value = enable;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Words after "set --" become $1...; they are copied since the command's
+ * own words go away with it. */
+static void set_positional(char **words) {
+    int count = 0;
+    while (words[count]) count++;
+
+    char **values = malloc((count + 1) * sizeof(char *));
+    for (int i = 0; i < count; ++i) values[i] = strdup(words[i]);
+    values[count] = NULL;
+
+    positional_free();
+    shell_params.values = values;
+    shell_params.count = count;
+    shell_params.owned = true;
+}
+
+int builtin_set(char **args) {
+    if (!args[1]) {
+        for (int i = 0; i < SET_OPTION_COUNT; ++i) {
+            output_printf(STDOUT_FILENO, "set -o %s\t%s\n", set_options[i].name,
+                    *set_options[i].value ? "on" : "off");
+        }
+        output_printf(STDOUT_FILENO, "set -j %d\n", jobs_limit());
+        return 0;
+    }
+
+    for (int i = 1; args[i]; ++i) {
+        if (!strcmp("--", args[i])) {
+            set_positional(args + i + 1);
+            break;
+        }
+        /* -j N bounds the running background jobs; 0 means one per CPU. */
+        if (!strcmp("-j", args[i]) && args[i + 1]) {
+            char *end;
+            long limit = strtol(args[++i], &end, 10);
+            if (*end || limit < 0 || limit > INT_MAX) {
+                output_printf(STDERR_FILENO, "set: -j: invalid job limit: %s\n", args[i]);
+                return 2;
+            }
+            shell_options.max_jobs = (int)limit;
+            jobs_schedule();
+            continue;
+        }
+        bool enable = !strcmp("-o", args[i]);
+        if ((enable || !strcmp("+o", args[i])) && args[i + 1] && set_option(args[i + 1], enable)) {
+            i++;
+            continue;
+        }
+        output_printf(STDERR_FILENO, "set: invalid option: %s\n", args[i]);
+        return 2;
+    }
+    return 0;
+}
+
+int builtin_tee(char **args) {
+    bool append = false;
+    int i = 1;
+    for (; args[i] && args[i][0] == '-' && args[i][1]; ++i) {
+        if (!strcmp(args[i], "--")) {
+            i++;
+            break;
+        }
+        if (strcmp(args[i], "-a")) return execute_external(args);
+        append = true;
+    }
+
+    int count = 0;
+    for (int j = i; args[j]; ++j) count++;
+    int *outs = malloc((count + 1) * sizeof(int));
+    int status = 0;
+    int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC);
+
+    struct sigaction saved;
+    copy_begin(&saved);
+    outs[0] = STDOUT_FILENO;
+    count = 1;
+    for (; args[i]; ++i) {
+        int fd = open(args[i], flags, 0666);
+        if (fd == -1) {
+            output_printf(STDERR_FILENO, "tee: %s: %s\n", args[i], strerror(errno));
+            status = 1;
+            continue;
+        }
+        outs[count++] = fd;
+    }
+
+    if (fd_tee(STDIN_FILENO, outs, count) < 0) {
+        if (shell_interrupted) status = 128 + SIGINT;
+        else {
+            output_perror("tee");
+            status = 1;
+        }
+    }
+    copy_end(&saved);
+    for (int j = 1; j < count; ++j) close(outs[j]);
+    free(outs);
+    return status;
+}
+
+typedef struct {
+    char **args;
+    int count;
+    int position;
+    bool error;
+} TestState;
+
+static bool test_or(TestState *state);
+
+static bool test_is_binary(const char *op) {
+    static const char *operators[] = {
+        "=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge", "-nt", "-ot", NULL
+    };
+    for (int i = 0; operators[i]; ++i) {
+        if (!strcmp(operators[i], op)) return true;
+    }
+    return false;
+}
+
+static bool test_is_unary(const char *op) {
+    return op[0] == '-' && op[1] && !op[2] && strchr("bcdefghLnprsStwxz", op[1]);
+}
+
+static bool test_integer(TestState *state, const char *value, long long *number) {
+    char *end;
+    errno = 0;
+    *number = strtoll(value, &end, 10);
+    if (errno || !*value || *end) {
+        output_printf(STDERR_FILENO, "test: %s: integer expression expected\n", value);
+        state->error = true;
+        return false;
+    }
+    return true;
+}
+
+static bool test_binary(TestState *state, const char *left, const char *op, const char *right) {
+    if (!strcmp("=", op) || !strcmp("==", op)) return !strcmp(left, right);
+    if (!strcmp("!=", op)) return strcmp(left, right) != 0;
+    if (!strcmp("<", op)) return strcmp(left, right) < 0;
+    if (!strcmp(">", op)) return strcmp(left, right) > 0;
+
+    if (!strcmp("-nt", op) || !strcmp("-ot", op)) {
+        struct stat left_st, right_st;
+        bool have_left = !stat(left, &left_st);
+        bool have_right = !stat(right, &right_st);
+        if (!strcmp("-ot", op)) {
+            const char *swap = left;
+            left = right;
+            right = swap;
+            bool swap_have = have_left;
+            have_left = have_right;
+            have_right = swap_have;
+            struct stat swap_st = left_st;
+            left_st = right_st;
+            right_st = swap_st;
+        }
+        if (!have_left) return false;
+        if (!have_right) return true;
+        if (left_st.st_mtim.tv_sec != right_st.st_mtim.tv_sec) {
+            return left_st.st_mtim.tv_sec > right_st.st_mtim.tv_sec;
+        }
+        return left_st.st_mtim.tv_nsec > right_st.st_mtim.tv_nsec;
+    }
+
+    long long a, b;
+    if (!test_integer(state, left, &a) || !test_integer(state, right, &b)) return false;
+    if (!strcmp("-eq", op)) return a == b;
+    if (!strcmp("-ne", op)) return a != b;
+    if (!strcmp("-lt", op)) return a < b;
+    if (!strcmp("-le", op)) return a <= b;
+    if (!strcmp("-gt", op)) return a > b;
+    return a >= b;
+}
+
+static bool test_unary(char op, const char *value) {
+    struct stat st;
+    switch (op) {
+        case 'n': return *value != '\0';
+        case 'z': return *value == '\0';
+        case 't': return isatty(atoi(value));
+        case 'r': return !access(value, R_OK);
+        case 'w': return !access(value, W_OK);
+        case 'x': return !access(value, X_OK);
+        case 'h':
+        case 'L': return !lstat(value, &st) && S_ISLNK(st.st_mode);
+    }
+
+    if (stat(value, &st)) return false;
+    switch (op) {
+        case 'e': return true;
+        case 'f': return S_ISREG(st.st_mode);
+        case 'd': return S_ISDIR(st.st_mode);
+        case 'b': return S_ISBLK(st.st_mode);
+        case 'c': return S_ISCHR(st.st_mode);
+        case 'p': return S_ISFIFO(st.st_mode);
+        case 'S': return S_ISSOCK(st.st_mode);
+        case 's': return st.st_size > 0;
+        case 'g': return (st.st_mode & S_ISGID) != 0;
+        case 'u': return (st.st_mode & S_ISUID) != 0;
+    }
+    return false;
+}
+
+static bool test_primary(TestState *state) {
+    if (state->position >= state->count) {
+        output_printf(STDERR_FILENO, "test: argument expected\n");
+        state->error = true;
+        return false;
+    }
+
+    char **args = state->args;
+    int pos = state->position;
+
+    if (pos + 2 < state->count && test_is_binary(args[pos + 1])) {
+        state->position += 3;
+        return test_binary(state, args[pos], args[pos + 1], args[pos + 2]);
+    }
+    if (!strcmp("!", args[pos])) {
+        state->position++;
+        return !test_primary(state);
+    }
+    if (!strcmp("(", args[pos]) && pos + 1 < state->count) {
+        state->position++;
+        bool value = test_or(state);
+        if (state->position >= state->count || strcmp(")", args[state->position])) {
+            output_printf(STDERR_FILENO, "test: ')' expected\n");
+            state->error = true;
+            return false;
+        }
+        state->position++;
+        return value;
+    }
+    if (test_is_unary(args[pos]) && pos + 1 < state->count) {
+        state->position += 2;
+        return test_unary(args[pos][1], args[pos + 1]);
+    }
+
+    state->position++;
+    return args[pos][0] != '\0';
+}
+
+static bool test_and(TestState *state) {
+    bool value = test_primary(state);
+    while (state->position < state->count && !strcmp("-a", state->args[state->position])) {
+        state->position++;
+        bool right = test_primary(state);
+        value = value && right;
+    }
+    return value;
+}
+
+static bool test_or(TestState *state) {
+    bool value = test_and(state);
+    while (state->position < state->count && !strcmp("-o", state->args[state->position])) {
+        state->position++;
+        bool right = test_and(state);
+        value = value || right;
+    }
+    return value;
+}
+
+int builtin_test(char **args) {
+    int count = 0;
+    while (args[count + 1]) count++;
+
+    if (!strcmp("[", args[0])) {
+        if (!count || strcmp("]", args[count])) {
+            output_printf(STDERR_FILENO, "[: missing ']'\n");
+            return 2;
+        }
+        count--;
+    }
+    if (!count) return 1;
+
+    TestState state = { args + 1, count, 0, false };
+    bool value = test_or(&state);
+    if (!state.error && state.position < state.count) {
+        output_printf(STDERR_FILENO, "test: %s: unexpected argument\n", args[state.position + 1]);
+        state.error = true;
+    }
+    if (state.error) return 2;
+    return value ? 0 : 1;
+}
+
+int builtin_true(char **args) {
+    (void)args;
+    return 0;
+}
+
+int builtin_unset(char **args) {
+    int status = 0;
+    bool functions = false;
+    for (int i = 1; args[i]; ++i) {
+        if (!strcmp("-v", args[i])) continue;
+        if (!strcmp("-f", args[i])) {
+            functions = true;
+            continue;
+        }
+        if (functions) {
+            function_unset(args[i]);
+            continue;
+        }
+        if (!is_identifier(args[i], strlen(args[i]))) {
+            output_printf(STDERR_FILENO, "unset: '%s': not a valid identifier\n", args[i]);
+            status = 1;
+            continue;
+        }
+        var_unset(args[i]);
+    }
+    return status;
+}
@@ -0,0 +1,352 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdalign.h>
+#include <stdbool.h>
+#include "compile.h"
+#include "output.h"
+
+#define UNWIND_PENDING -1
+
+/* Compiling runs twice over the tree: once with code and pool NULL to
+ * measure them, then again to fill the block sized by the first run. */
+typedef struct {
+    Instruction *code;
+    char *pool;
+    int length;
+    size_t pool_size;
+    int loops;
+    int max_loops;
+    int max_stages;
+    bool walk;
+} Compiler;
+
+static size_t align_up(size_t size, size_t align) {
+    return (size + align - 1) & ~(align - 1);
+}
+
+static int pool_alloc(Compiler *c, size_t size, size_t align) {
+    size_t offset = align_up(c->pool_size, align);
+    c->pool_size = offset + size;
+    return offset;
+}
+
+static void *pool_at(Compiler *c, int offset) {
+    return c->pool ? c->pool + offset : NULL;
+}
+
+static char *pack_string(Compiler *c, const char *text) {
+    if (!text) return NULL;
+    size_t length = strlen(text) + 1;
+    char *copy = pool_at(c, pool_alloc(c, length, 1));
+    if (copy) memcpy(copy, text, length);
+    return copy;
+}
+
+static char **pack_words(Compiler *c, char **words) {
+    if (!words) return NULL;
+    int count = 0;
+    while (words[count]) count++;
+
+    char **copy = pool_at(c, pool_alloc(c, (count + 1) * sizeof(char *), alignof(char *)));
+    for (int i = 0; i < count; ++i) {
+        char *word = pack_string(c, words[i]);
+        if (copy) copy[i] = word;
+    }
+    if (copy) copy[count] = NULL;
+    return copy;
+}
+
+/* Copies a subtree into the pool, each node followed by its words. */
+static int pack_node(Compiler *c, ASTNode *node) {
+    int offset = pool_alloc(c, sizeof(ASTNode), alignof(ASTNode));
+    ASTNode packed = *node;
+
+    packed.args = pack_words(c, node->args);
+    packed.input_file = pack_string(c, node->input_file);
+    packed.here_text = pack_string(c, node->here_text);
+    packed.output_file = pack_string(c, node->output_file);
+    packed.name = pack_string(c, node->name);
+    packed.left = node->left ? pool_at(c, pack_node(c, node->left)) : NULL;
+    packed.right = node->right ? pool_at(c, pack_node(c, node->right)) : NULL;
+    if (node->child_count) {
+        ASTNode **children = pool_at(c, pool_alloc(c, node->child_count * sizeof(ASTNode *), alignof(ASTNode *)));
+        for (int i = 0; i < node->child_count; ++i) {
+            ASTNode *child = pool_at(c, pack_node(c, node->children[i]));
+            if (children) children[i] = child;
+        }
+        packed.children = children;
+    }
+
+    ASTNode *copy = pool_at(c, offset);
+    if (copy) *copy = packed;
+    return offset;
+}
+
+static int emit_flags(Compiler *c, OpCode op, int flags, int operand) {
+    if (c->code) {
+        Instruction instruction = { op, flags, operand, UNWIND_PENDING };
+        c->code[c->length] = instruction;
+    }
+    return c->length++;
+}
+
+static int emit(Compiler *c, OpCode op, int operand) {
+    return emit_flags(c, op, 0, operand);
+}
+
+static void patch(Compiler *c, int at, int target) {
+    if (c->code) c->code[at].operand = target;
+}
+
+/* Points the instructions in [from, to) that no inner loop claimed at
+ * target. */
+static void set_unwind(Compiler *c, int from, int to, int target) {
+    if (!c->code) return;
+    for (int i = from; i < to; ++i) {
+        if (c->code[i].unwind == UNWIND_PENDING) c->code[i].unwind = target;
+    }
+}
+
+/* Stages are packed one by one so that each PIPE can name its own; the
+ * pipeline node kept for WAIT shares them. */
+static void compile_pipeline(Compiler *c, ASTNode *node) {
+    int count = node->child_count;
+    int *stages = malloc(count * sizeof(int));
+    for (int i = 0; i < count; ++i) stages[i] = pack_node(c, node->children[i]);
+
+    ASTNode **children = pool_at(c, pool_alloc(c, count * sizeof(ASTNode *), alignof(ASTNode *)));
+    int offset = pool_alloc(c, sizeof(ASTNode), alignof(ASTNode));
+    ASTNode *pipeline = pool_at(c, offset);
+    if (pipeline) {
+        ASTNode packed = { .type = NODE_PIPE, .children = children, .child_count = count };
+        *pipeline = packed;
+    }
+
+    for (int i = 0; i < count; ++i) {
+        if (children) children[i] = pool_at(c, stages[i]);
+        int flags = (i == 0 ? PIPE_FIRST : 0) | (i == count - 1 ? PIPE_LAST : 0);
+        emit_flags(c, OP_PIPE, flags, stages[i]);
+    }
+    emit(c, OP_WAIT, offset);
+    if (count > c->max_stages) c->max_stages = count;
+    free(stages);
+}
+
+static void compile_node(Compiler *c, ASTNode *node);
+
+/* while and until test their condition at the top; for steps through its
+ * words with FOR_NEXT. A pending break or continue reaches LOOP_TEST or
+ * LOOP_NEXT through the unwind targets of the condition and body. */
+static void compile_loop(Compiler *c, ASTNode *node) {
+    if (++c->loops > c->max_loops) c->max_loops = c->loops;
+
+    int test;
+    if (node->type == NODE_FOR) {
+        ASTNode header = *node;
+        header.left = NULL;
+        emit(c, OP_FOR_ENTER, pack_node(c, &header));
+        test = emit(c, OP_FOR_NEXT, 0);
+    }
+    else {
+        emit(c, OP_LOOP_ENTER, 0);
+        int condition = c->length;
+        compile_node(c, node->left);
+        test = emit_flags(c, OP_LOOP_TEST, node->type == NODE_UNTIL ? LOOP_UNTIL : 0, 0);
+        set_unwind(c, condition, test, test);
+    }
+
+    int body = c->length;
+    compile_node(c, node->type == NODE_FOR ? node->left : node->right);
+    int next = emit(c, OP_LOOP_NEXT, 0);
+    set_unwind(c, body, next, next);
+
+    int exit = emit(c, OP_LOOP_EXIT, 0);
+    patch(c, test, exit);
+    patch(c, next, exit);
+    c->loops--;
+}
+
+static void compile_if(Compiler *c, ASTNode *node) {
+    compile_node(c, node->children[0]);
+    int otherwise = emit(c, OP_JUMP_IF_FAIL, 0);
+    compile_node(c, node->children[1]);
+    int end = emit(c, OP_JUMP, 0);
+
+    patch(c, otherwise, c->length);
+    if (node->child_count > 2) compile_node(c, node->children[2]);
+    else emit(c, OP_STATUS, 0);
+    patch(c, end, c->length);
+}
+
+/* GUARD falls through to a JUMP to the tree as written when one of its
+ * names is a function, and otherwise skips it into the rewritten one. */
+static void compile_guard(Compiler *c, ASTNode *node) {
+    ASTNode names = { .type = NODE_GUARD, .args = node->args };
+    emit(c, OP_GUARD, pack_node(c, &names));
+    int original = emit(c, OP_JUMP, 0);
+    compile_node(c, node->left);
+    int end = emit(c, OP_JUMP, 0);
+
+    patch(c, original, c->length);
+    compile_node(c, node->right);
+    patch(c, end, c->length);
+}
+
+static void compile_node(Compiler *c, ASTNode *node) {
+    if (!node) {
+        emit(c, OP_STATUS, 0);
+        return;
+    }
+    if (c->walk) {
+        emit(c, OP_EXEC, pack_node(c, node));
+        return;
+    }
+
+    bool redirected = node->input_file || node->here_text || node->output_file;
+    switch (node->type) {
+        case NODE_COMMAND:
+            emit(c, OP_SPAWN, pack_node(c, node));
+            return;
+
+        case NODE_PIPE:
+            compile_pipeline(c, node);
+            return;
+
+        case NODE_AND:
+        case NODE_OR: {
+            compile_node(c, node->left);
+            int jump = emit(c, node->type == NODE_AND ? OP_JUMP_IF_FAIL : OP_JUMP_IF_OK, 0);
+            compile_node(c, node->right);
+            patch(c, jump, c->length);
+            return;
+        }
+
+        case NODE_SEQUENCE:
+            if (!node->child_count) {
+                compile_node(c, node->left);
+                compile_node(c, node->right);
+            }
+            for (int i = 0; i < node->child_count; ++i) compile_node(c, node->children[i]);
+            return;
+
+        case NODE_BACKGROUND:
+            emit(c, OP_BG, pack_node(c, node->left));
+            return;
+
+        case NODE_GUARD:
+            compile_guard(c, node);
+            return;
+
+        /* Compounds with redirections keep them around the whole body, so
+         * they run as trees. */
+        case NODE_GROUP:
+            if (redirected) break;
+            compile_node(c, node->left);
+            return;
+
+        case NODE_IF:
+            if (redirected) break;
+            compile_if(c, node);
+            return;
+
+        case NODE_WHILE:
+        case NODE_UNTIL:
+        case NODE_FOR:
+            if (redirected) break;
+            compile_loop(c, node);
+            return;
+
+        default:
+            break;
+    }
+    emit(c, OP_EXEC, pack_node(c, node));
+}
+
+static Program *compile(Arena *arena, ASTNode *ast, bool walk) {
+    if (!ast) return NULL;
+
+    Compiler measure = { .walk = walk };
+    compile_node(&measure, ast);
+
+    size_t pool_offset = align_up(sizeof(Program), alignof(max_align_t));
+    size_t code_offset = align_up(pool_offset + measure.pool_size, alignof(Instruction));
+    char *block = arena_alloc(arena, code_offset + measure.length * sizeof(Instruction));
+
+    Compiler c = { .walk = walk };
+    c.code = (Instruction *)(block + code_offset);
+    c.pool = block + pool_offset;
+    compile_node(&c, ast);
+    set_unwind(&c, 0, c.length, c.length);
+
+    Program *program = (Program *)block;
+    program->code = c.code;
+    program->length = c.length;
+    program->pool = c.pool;
+    program->pool_size = c.pool_size;
+    program->max_loops = measure.max_loops;
+    program->max_stages = measure.max_stages;
+    return program;
+}
+
+Program *compile_ast(Arena *arena, ASTNode *ast) {
+    return compile(arena, ast, false);
+}
+
+Program *compile_tree(Arena *arena, ASTNode *ast) {
+    return compile(arena, ast, true);
+}
+
+void print_program(const Program *program) {
+    static const char *const names[] = { "SPAWN", "PIPE", "WAIT", "BG", "EXEC", "JUMP", "JUMP_IF_FAIL",
+            "JUMP_IF_OK", "STATUS", "LOOP_ENTER", "FOR_ENTER", "FOR_NEXT", "LOOP_TEST", "LOOP_NEXT",
+            "LOOP_EXIT", "GUARD" };
+
+    output_printf(STDOUT_FILENO, "Program: %d instructions, %zu pool bytes\n", program->length, program->pool_size);
+    for (int i = 0; i < program->length; ++i) {
+        const Instruction *instruction = &program->code[i];
+        output_printf(STDOUT_FILENO, "  %4d %s", i, names[instruction->op]);
+        int pad = 13 - (int)strlen(names[instruction->op]);
+
+        switch (instruction->op) {
+            case OP_SPAWN:
+            case OP_PIPE:
+            case OP_WAIT:
+            case OP_BG:
+            case OP_EXEC: {
+                char *text = ast_to_string(PROGRAM_NODE(program, instruction->operand));
+                output_printf(STDOUT_FILENO, "%*s%s", pad, "", text);
+                free(text);
+                break;
+            }
+            case OP_GUARD: {
+                ASTNode *node = PROGRAM_NODE(program, instruction->operand);
+                output_printf(STDOUT_FILENO, "%*s", pad, "");
+                for (int j = 0; node->args[j]; ++j) output_printf(STDOUT_FILENO, j ? " %s" : "%s", node->args[j]);
+                break;
+            }
+            case OP_FOR_ENTER: {
+                ASTNode *node = PROGRAM_NODE(program, instruction->operand);
+                output_printf(STDOUT_FILENO, "%*s%s", pad, "", node->name);
+                if (node->args) output_puts(STDOUT_FILENO, " in");
+                for (int j = 0; node->args && node->args[j]; ++j) {
+                    output_printf(STDOUT_FILENO, " %s", node->args[j]);
+                }
+                break;
+            }
+            case OP_JUMP:
+            case OP_JUMP_IF_FAIL:
+            case OP_JUMP_IF_OK:
+            case OP_STATUS:
+            case OP_FOR_NEXT:
+            case OP_LOOP_TEST:
+            case OP_LOOP_NEXT:
+                output_printf(STDOUT_FILENO, "%*s%d", pad, "", instruction->operand);
+                break;
+            default:
+                break;
+        }
+        output_puts(STDOUT_FILENO, "\n");
+    }
+}
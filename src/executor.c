@@ -3,32 +3,520 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <spawn.h>
+#include <signal.h>
+#include <stdbool.h>
 #include "executor.h"
+#include "pathcache.h"
+#include "builtins.h"
+#include "jobs.h"
+#include "input.h"
+#include "astcache.h"
+#include "functions.h"
+#include "optimizer.h"
+#include "expand.h"
+#include "variables.h"
+#include "timing.h"
+#include "trace.h"
+#include "fdcopy.h"
+#include "output.h"
 
-void execute_cd(ASTNode *node) {
-    if (chdir(node->args[1])) perror("cd failed");
-}
+ShellOptions shell_options = { false, true, false, false, false, true, 0 };
+ControlState shell_control = { CONTROL_NONE, 0, 0, 0 };
+PositionalParams shell_params = { "myshell", NULL, 0, false };
+volatile sig_atomic_t shell_interrupted = 0;
+int shell_last_status = 0;
+bool shell_interactive = false;
+pid_t shell_pid = 0;
+
+static const int job_control_signals[] = { SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU };
+
+#define JOB_CONTROL_SIGNAL_COUNT (int)(sizeof(job_control_signals) / sizeof(job_control_signals[0]))
+
+static bool in_child = false;
+
+/* Expanded words and substitution trees, released when their command ends. */
+static Arena scratch;
+static unsigned long capture_count = 0;
+
+/* Process substitutions of the commands running now: the shell's end of
+ * each pipe and the process on the other end. */
+typedef struct {
+    int fd;
+    pid_t pid;
+} ProcessSubstitution;
 
+static ProcessSubstitution *processes = NULL;
+static int process_count = 0;
+static int process_capacity = 0;
+
+/* Forked children leave with _exit so that stdio does not rewind or flush
+ * streams that still belong to the parent. The shell itself leaves its
+ * status in shell_last_status for exit handlers. */
 void execute_exit(int status) {
+    output_flush_all();
+    shell_last_status = status;
+    if (in_child) _exit(status);
     exit(status);
 }
 
+static int open_pipe(int pipefd[2]) {
+    if (pipe(pipefd) == -1) return -1;
+    fcntl(pipefd[0], F_SETFD, FD_CLOEXEC);
+    fcntl(pipefd[1], F_SETFD, FD_CLOEXEC);
+    return 0;
+}
+
+static bool is_spawnable(ASTNode *node) {
+    return node->type == NODE_COMMAND && !node->expand && !node->assignments && node->args && node->args[0] &&
+            !find_builtin(node->args[0]) && !function_find(node->args[0]);
+}
+
+/* Whether a function now has one of the names an optimizer guard lists. */
+static bool is_shadowed(char **names) {
+    for (int i = 0; names[i]; ++i) {
+        if (function_find(names[i])) return true;
+    }
+    return false;
+}
+
+/* Follows optimizer guards to the tree that should run now. */
+static ASTNode *unguard(ASTNode *node) {
+    while (node->type == NODE_GUARD) node = is_shadowed(node->args) ? node->right : node->left;
+    return node;
+}
+
+int wait_status(int status) {
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return -1;
+}
+
+/* A readable descriptor holding a here-document or here-string, which gets
+ * its newline here. */
+static int open_here(ASTNode *node) {
+    size_t length = strlen(node->here_text);
+    int fd;
+    if (node->here == HERE_STRING) {
+        char *text = malloc(length + 2);
+        memcpy(text, node->here_text, length);
+        text[length] = '\n';
+        fd = fd_from_text(text, length + 1);
+        free(text);
+    }
+    else fd = fd_from_text(node->here_text, length);
+    if (fd == -1) perror("here-document failed");
+    return fd;
+}
+
+static void report_spawn_error(ASTNode *node, int error) {
+    if (node->input_file) {
+        int fd = open(node->input_file, O_RDONLY);
+        if (fd == -1) {
+            perror("input file opening failed");
+            return;
+        }
+        close(fd);
+    }
+
+    if (node->output_file) {
+        int flags = O_WRONLY | O_CREAT | (node->append ? O_APPEND : O_TRUNC);
+        int fd = open(node->output_file, flags, 0644);
+        if (fd == -1) {
+            perror("output file opening failed");
+            return;
+        }
+        close(fd);
+    }
+
+    fprintf(stderr, "%s: %s\n", node->args[0],
+            error == ENOENT ? "command not found" : strerror(error));
+}
+
+/* Launches a simple command without copying the shell's address space:
+ * glibc's posix_spawn uses clone(CLONE_VM|CLONE_VFORK), and redirections are
+ * applied in the child as file actions. in_fd/out_fd replace stdin/stdout
+ * when they are not already the standard descriptors; pgid < 0 keeps the
+ * child in the shell's process group. Bare command names are resolved
+ * through the PATH cache instead of letting execvp probe every directory. */
+int spawn_command(ASTNode *node, int in_fd, int out_fd, pid_t pgid, pid_t *pid) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+
+    output_flush_all();
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attr);
+
+    if (in_fd != STDIN_FILENO) posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+    if (out_fd != STDOUT_FILENO) posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+
+    if (node->input_file) {
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, node->input_file, O_RDONLY, 0);
+    }
+    int here_fd = node->here_text ? open_here(node) : -1;
+    if (here_fd >= 0) posix_spawn_file_actions_adddup2(&actions, here_fd, STDIN_FILENO);
+    else if (node->here_text) {
+        posix_spawn_file_actions_destroy(&actions);
+        posix_spawnattr_destroy(&attr);
+        return EIO;
+    }
+    if (node->output_file) {
+        int flags = O_WRONLY | O_CREAT | (node->append ? O_APPEND : O_TRUNC);
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, node->output_file, flags, 0644);
+    }
+
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    for (int i = 0; i < JOB_CONTROL_SIGNAL_COUNT; ++i) sigaddset(&defaults, job_control_signals[i]);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    posix_spawnattr_setsigmask(&attr, &mask);
+
+    short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+    if (pgid >= 0) {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attr, pgid);
+    }
+    posix_spawnattr_setflags(&attr, flags);
+
+    const char *name = node->args[0];
+    const char *path = strchr(name, '/') ? name : path_lookup(name);
+    TRACE_BEGIN(span);
+    int error = path ? posix_spawn(pid, path, &actions, &attr, node->args, var_environ()) : ENOENT;
+
+    if (error == ENOENT && path && path != name) {
+        path_cache_forget(name);
+        path = path_lookup(name);
+        error = path ? posix_spawn(pid, path, &actions, &attr, node->args, var_environ()) : ENOENT;
+    }
+    /* posix_spawn returns once the child has called exec. */
+    TRACE_END(span, "spawn", name);
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    if (here_fd >= 0) close(here_fd);
+
+    if (error) report_spawn_error(node, error);
+    return error;
+}
+
+void give_terminal(pid_t pgid) {
+    if (shell_interactive) tcsetpgrp(STDIN_FILENO, pgid);
+}
+
+/* Forked children run shell code but must never take over the terminal,
+ * and the parent's jobs are not theirs to reap. Pending output is written
+ * first so that the child does not inherit a copy of it. */
+static pid_t fork_child(void) {
+    output_flush_all();
+    TRACE_BEGIN(span);
+    pid_t pid = fork();
+    if (pid > 0) TRACE_END(span, "fork", NULL);
+    if (pid < 0) perror("fork failed");
+    if (!pid) {
+        in_child = true;
+        shell_interactive = false;
+        for (int i = 0; i < JOB_CONTROL_SIGNAL_COUNT; ++i) signal(job_control_signals[i], SIG_DFL);
+        jobs_clear();
+    }
+    return pid;
+}
+
+static void record_stage(ASTNode *node, int index, int status, const struct timespec *start,
+        const struct rusage *usage) {
+    struct timespec end;
+    TimingSample sample;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    timing_sample(&sample, start, &end, usage);
+
+    char *text = ast_to_string(node);
+    timing_record("stage", index, text, status, &sample);
+    free(text);
+}
+
+/* Waits for the processes of a foreground job. pgid is the job's process
+ * group when job control is on, -1 otherwise. A job stopped from the
+ * terminal moves to the job table with the processes that are still alive.
+ * Pipelines pass the time they started in stages_start, and with timing on
+ * each stage is recorded as it is reaped. */
+static int wait_foreground(ASTNode *node, pid_t pgid, pid_t *pids, int count, const struct timespec *stages_start) {
+    if (pgid > 0 && shell_interactive) {
+        give_terminal(pgid);
+        kill(-pgid, SIGCONT);
+    }
+
+    TRACE_BEGIN(span);
+    int result = 0;
+    for (int i = 0; i < count; ++i) {
+        int status = 127;
+        if (pids[i] > 0) {
+            int raw;
+            struct rusage usage;
+            pid_t reaped;
+            while ((reaped = wait4(pids[i], &raw, WUNTRACED, &usage)) < 0 && errno == EINTR);
+            /* The SIGCHLD handler may have reaped it for a job first. */
+            if (reaped < 0) {
+                memset(&usage, 0, sizeof(usage));
+                if (!jobs_reaped_status(pids[i], &raw)) raw = 127 << 8;
+            }
+            if (WIFSTOPPED(raw)) {
+                jobs_add(pgid > 0 ? pgid : pids[i], pids + i, count - i, node, JOB_STOPPED);
+                result = 128 + WSTOPSIG(raw);
+                break;
+            }
+            status = wait_status(raw);
+            if (WIFSIGNALED(raw) && WTERMSIG(raw) == SIGINT) shell_interrupted = 1;
+            timing_child(&usage);
+            if (stages_start && shell_options.timing) {
+                record_stage(node->children[i], i, status, stages_start, &usage);
+            }
+        }
+        if (i == count - 1 && !(shell_options.pipefail && result)) result = status;
+        else if (shell_options.pipefail && status) result = status;
+    }
+
+    if (pgid > 0) give_terminal(getpgrp());
+    TRACE_END(span, "wait", node->type == NODE_COMMAND ? node->args[0] : NULL);
+    return result;
+}
+
 int execute_command(ASTNode *node) {
     if (!node || node->type != NODE_COMMAND) return -1;
 
+    pid_t pid;
+    int error = spawn_command(node, STDIN_FILENO, STDOUT_FILENO, shell_interactive ? 0 : -1, &pid);
+    if (error) return error == ENOENT ? 127 : 126;
+
+    return wait_foreground(node, shell_interactive ? pid : -1, &pid, 1, NULL);
+}
+
+/* Runs args as an external program, skipping builtins and functions of the
+ * same name. Builtins use it for options they do not implement. */
+int execute_external(char **args) {
+    ASTNode node = { .type = NODE_COMMAND, .args = args };
+    return execute_command(&node);
+}
+
+/* Stages and background jobs are recorded by the shell that waits for them,
+ * so the child does not time them again. */
+static int execute_expanded(ASTNode *node);
+static int execute_node_expanded(ASTNode *expanded, unsigned long captures);
+
+/* Expands a command about to run in a child in the shell itself, when that
+ * cannot tell, so that it can still be spawned. Results are in scratch
+ * from mark; the node itself is returned when it is left to the child, and
+ * NULL when the expansion failed. */
+static ASTNode *expand_for_child(ASTNode *node, ArenaMark *mark) {
+    if (node->type != NODE_COMMAND || !node->expand || !expand_is_pure(node)) return node;
+
+    if (!scratch.head) arena_init(&scratch);
+    *mark = arena_mark(&scratch);
+    TRACE_BEGIN(span);
+    ASTNode *expanded = expand_node(&scratch, node);
+    TRACE_END(span, "expand", NULL);
+    return expanded;
+}
+
+/* Runs a node in a child that got it from expand_for_child. */
+static int execute_in_child(ASTNode *node, ASTNode *expanded) {
+    if (!expanded) return 1;
+    return expanded == node ? execute_expanded(node) : execute_node_expanded(expanded, capture_count);
+}
+
+/* Starts one pipeline stage in process group pgid (0 starts a new group).
+ * Simple commands are spawned directly, after expanding their words here;
+ * anything that has to run shell code (subshells, builtins, functions,
+ * nested lists) gets a forked copy of the shell. */
+static pid_t launch_stage(ASTNode *node, int in_fd, int out_fd, pid_t pgid) {
+    pid_t pid;
+    ArenaMark mark;
+    node = unguard(node);
+    ASTNode *expanded = expand_for_child(node, &mark);
+
+    if (expanded && is_spawnable(expanded)) {
+        int error = spawn_command(expanded, in_fd, out_fd, pgid, &pid);
+        if (expanded != node) arena_restore(&scratch, mark);
+        return error ? -1 : pid;
+    }
+
+    pid = fork_child();
+    if (expanded != node && pid) arena_restore(&scratch, mark);
+    if (pid < 0) return -1;
+    if (!pid) {
+        if (pgid >= 0) setpgid(0, pgid);
+        if (in_fd != STDIN_FILENO) {
+            dup2(in_fd, STDIN_FILENO);
+            close(in_fd);
+        }
+        if (out_fd != STDOUT_FILENO) {
+            dup2(out_fd, STDOUT_FILENO);
+            close(out_fd);
+        }
+        execute_exit(execute_in_child(node, expanded));
+    }
+    if (pgid >= 0) setpgid(pid, pgid ? pgid : pid);
+    return pid;
+}
+
+/* A pipeline whose stages are being started one by one. */
+typedef struct {
+    pid_t *pids;
+    int launched;
+    int in_fd;
+    pid_t pgid;
+    bool broken;
+    struct timespec start;
+} Pipeline;
+
+static void pipeline_begin(Pipeline *pipeline, pid_t *pids) {
+    pipeline->pids = pids;
+    pipeline->launched = 0;
+    pipeline->in_fd = STDIN_FILENO;
+    pipeline->pgid = shell_interactive ? 0 : -1;
+    pipeline->broken = false;
+    clock_gettime(CLOCK_MONOTONIC, &pipeline->start);
+}
+
+/* Starts the next stage reading from the previous one and, unless it is
+ * the last, writing into a new pipe. Once a pipe fails no further stage is
+ * started. */
+static void pipeline_launch(Pipeline *pipeline, ASTNode *stage, bool last) {
+    if (pipeline->broken) return;
+
+    int pipefd[2] = { -1, -1 };
+    int out_fd = STDOUT_FILENO;
+    if (!last) {
+        if (open_pipe(pipefd) == -1) {
+            perror("pipe failed");
+            pipeline->broken = true;
+            return;
+        }
+        out_fd = pipefd[1];
+    }
+
+    pid_t pid = launch_stage(stage, pipeline->in_fd, out_fd, pipeline->pgid);
+    pipeline->pids[pipeline->launched++] = pid;
+    if (pid > 0 && !pipeline->pgid) pipeline->pgid = pid;
+
+    if (pipeline->in_fd != STDIN_FILENO) close(pipeline->in_fd);
+    if (out_fd != STDOUT_FILENO) close(out_fd);
+    pipeline->in_fd = pipefd[0];
+}
+
+static int pipeline_wait(Pipeline *pipeline, ASTNode *node) {
+    if (pipeline->in_fd != STDIN_FILENO && pipeline->in_fd != -1) close(pipeline->in_fd);
+    int result = wait_foreground(node, pipeline->pgid, pipeline->pids, pipeline->launched, &pipeline->start);
+    return pipeline->broken ? -1 : result;
+}
+
+/* Runs every stage of a pipeline as a direct child of the shell, in one
+ * process group, and waits for all of them. */
+int execute_pipeline(ASTNode *node) {
+    int count = node->child_count;
+    pid_t *pids = malloc(count * sizeof(pid_t));
+    Pipeline pipeline;
+    pipeline_begin(&pipeline, pids);
+    for (int i = 0; i < count; ++i) pipeline_launch(&pipeline, node->children[i], i == count - 1);
+
+    int result = pipeline_wait(&pipeline, node);
+    free(pids);
+    return result;
+}
+
+/* Starts node in its own process group without waiting for it. Called with
+ * SIGCHLD blocked so the job can be registered before it is reaped; the
+ * child gets the unblocked mask back. A job that was queued passes the
+ * directory and, unless its words are already expanded, the variables it
+ * was submitted with; the child is then forked to put them back. */
+pid_t launch_background(ASTNode *node, const char *cwd, const VarSnapshot *vars) {
+    pid_t pid;
+    ArenaMark mark;
+    node = unguard(node);
+    ASTNode *expanded = expand_for_child(node, &mark);
+
+    if (!cwd && !vars && expanded && is_spawnable(expanded)) {
+        int error = spawn_command(expanded, STDIN_FILENO, STDOUT_FILENO, 0, &pid);
+        if (expanded != node) arena_restore(&scratch, mark);
+        return error ? -1 : pid;
+    }
+
+    pid = fork_child();
+    if (expanded != node && pid) arena_restore(&scratch, mark);
+    if (pid < 0) return -1;
+    if (!pid) {
+        sigset_t empty;
+        sigemptyset(&empty);
+        sigprocmask(SIG_SETMASK, &empty, NULL);
+        setpgid(0, 0);
+        if (cwd && chdir(cwd) == -1) {
+            perror(cwd);
+            execute_exit(1);
+        }
+        if (vars) var_restore(vars);
+        execute_exit(execute_in_child(node, expanded));
+    }
+    setpgid(pid, pid);
+    return pid;
+}
+
+/* Copies a background command that has to wait for a slot into arena.
+ * A simple command is expanded now, and *fixed tells whether that left
+ * nothing for the variables to change before it starts. Returns NULL if
+ * the expansion failed. */
+ASTNode *background_copy(Arena *arena, ASTNode *node, bool *fixed) {
+    ArenaMark mark;
+    node = unguard(node);
+    ASTNode *expanded = expand_for_child(node, &mark);
+    if (!expanded) {
+        arena_restore(&scratch, mark);
+        return NULL;
+    }
+    *fixed = expanded->type == NODE_COMMAND && !expanded->expand && !expanded->assignments && expanded->args &&
+            expanded->args[0] && !function_find(expanded->args[0]);
+
+    ASTNode *copy = ast_clone(arena, expanded);
+    if (expanded != node) arena_restore(&scratch, mark);
+    return copy;
+}
+
+static int save_fd(int fd) {
+    return fcntl(fd, F_DUPFD_CLOEXEC, 10);
+}
+
+static void restore_fd(int saved, int fd) {
+    if (saved < 0) return;
+    dup2(saved, fd);
+    close(saved);
+}
+
+/* Applies a node's redirections to the shell's own descriptors, saving the
+ * originals in saved[0] (stdin) and saved[1] (stdout) for
+ * undo_redirections. Returns -1 if a file cannot be opened. */
+static int redirect_in_process(ASTNode *node, int saved[2]) {
+    saved[0] = saved[1] = -1;
+
     if (node->input_file) {
         int fd = open(node->input_file, O_RDONLY);
         if (fd == -1) {
             perror("input file opening failed");
             return -1;
         }
-        if (dup2(fd, STDIN_FILENO) == -1) {
-            perror("dup2 input failed");
-            close(fd);
-            return -1;
-        }
+        saved[0] = save_fd(STDIN_FILENO);
+        dup2(fd, STDIN_FILENO);
+        close(fd);
+    }
+
+    if (node->here_text) {
+        int fd = open_here(node);
+        if (fd == -1) return -1;
+        saved[0] = save_fd(STDIN_FILENO);
+        dup2(fd, STDIN_FILENO);
         close(fd);
     }
 
@@ -37,92 +525,234 @@ int execute_command(ASTNode *node) {
         int fd = open(node->output_file, flags, 0644);
         if (fd == -1) {
             perror("output file opening failed");
+            restore_fd(saved[0], STDIN_FILENO);
             return -1;
         }
-        if (dup2(fd, STDOUT_FILENO) == -1) {
-            perror("dup2 output failed");
-            close(fd);
-            return -1;
-        }
+        output_flush_all();
+        saved[1] = save_fd(STDOUT_FILENO);
+        dup2(fd, STDOUT_FILENO);
         close(fd);
     }
+    return 0;
+}
 
-    execvp(node->args[0], node->args);
-    perror("execvp failed");
-    return -1;
+static void undo_redirections(int saved[2]) {
+    if (saved[1] >= 0) output_flush_all();
+    restore_fd(saved[1], STDOUT_FILENO);
+    restore_fd(saved[0], STDIN_FILENO);
 }
 
-int execute_ast(ASTNode *node) {
-    if (!node) return 0;
+/* Runs a builtin inside the shell process. Redirections are applied to the
+ * shell's own descriptors for the duration of the call and undone after. */
+int execute_builtin(const Builtin *builtin, ASTNode *node) {
+    int saved[2];
+    if (redirect_in_process(node, saved)) return 1;
+
+    int status = builtin->func(node->args);
+    undo_redirections(saved);
+    return status;
+}
+
+void positional_free(void) {
+    if (!shell_params.owned) return;
+    for (int i = 0; i < shell_params.count; ++i) free(shell_params.values[i]);
+    free(shell_params.values);
+    shell_params.owned = false;
+}
+
+/* Calls a shell function in the shell process with the command's arguments
+ * as positional parameters. break and continue do not reach loops in the
+ * caller. */
+static int execute_function(Function *function, ASTNode *node) {
+    int saved[2];
+    if (redirect_in_process(node, saved)) return 1;
+
+    PositionalParams params = shell_params;
+    int loop_depth = shell_control.loop_depth;
+    shell_params.values = node->args + 1;
+    shell_params.owned = false;
+    shell_params.count = 0;
+    while (shell_params.values[shell_params.count]) shell_params.count++;
+    shell_control.loop_depth = 0;
+    shell_control.function_depth++;
+    function_retain(function);
+
+    int status = execute_program(function->body);
+    if (shell_control.flow == CONTROL_RETURN) shell_control.flow = CONTROL_NONE;
+
+    function_release(function);
+    shell_control.function_depth--;
+    shell_control.loop_depth = loop_depth;
+    positional_free();
+    shell_params = params;
+    undo_redirections(saved);
+    return status;
+}
+
+/* Consumes a break or continue aimed at the current loop. Returns true when
+ * the loop has to stop, including for return and interrupts. */
+static bool loop_interrupted(void) {
+    if (shell_interrupted) return true;
+
+    switch (shell_control.flow) {
+        case CONTROL_NONE:
+            return false;
+        case CONTROL_BREAK:
+            if (--shell_control.levels == 0) shell_control.flow = CONTROL_NONE;
+            return true;
+        case CONTROL_CONTINUE:
+            if (--shell_control.levels > 0) return true;
+            shell_control.flow = CONTROL_NONE;
+            return false;
+        default:
+            return true;
+    }
+}
+
+static int execute_loop(ASTNode *node) {
+    int status = 0;
+    shell_control.loop_depth++;
+
+    while (1) {
+        int condition = execute_ast(node->left);
+        if (shell_control.flow != CONTROL_NONE || shell_interrupted) {
+            if (loop_interrupted()) break;
+            continue;
+        }
+        if ((condition == 0) != (node->type == NODE_WHILE)) break;
+
+        status = execute_ast(node->right);
+        if (loop_interrupted()) break;
+    }
+
+    shell_control.loop_depth--;
+    return status;
+}
+
+/* 'for NAME' goes over a copy of $1..., which set -- in the body may free. */
+static char **positional_words(void) {
+    char **words = arena_alloc(&scratch, (shell_params.count + 1) * sizeof(char *));
+    for (int i = 0; i < shell_params.count; ++i) words[i] = arena_strdup(&scratch, shell_params.values[i]);
+    words[shell_params.count] = NULL;
+    return words;
+}
+
+static int execute_for(ASTNode *node) {
+    if (!scratch.head) arena_init(&scratch);
+    ArenaMark mark = arena_mark(&scratch);
+    char **words = node->args ? node->args : positional_words();
+    int status = 0;
+    shell_control.loop_depth++;
+
+    for (int i = 0; words && words[i]; ++i) {
+        var_set(node->name, words[i], false);
+        status = execute_ast(node->left);
+        if (loop_interrupted()) break;
+    }
+
+    shell_control.loop_depth--;
+    arena_restore(&scratch, mark);
+    return status;
+}
 
+static int execute_compound(ASTNode *node) {
     switch (node->type) {
-        case NODE_COMMAND: {
-            if (node->args && !strcmp("cd", node->args[0])) {
-                execute_cd(node);
-            }
+        case NODE_GROUP:
+            return execute_ast(node->left);
 
-            else {
-                pid_t pid = fork();
-                if (pid < 0) {
-                    perror("fork failed");
-                    return -1;
-                }
-                if (!pid) {
-                    exit(execute_command(node));
-                }
-                int status;
-                waitpid(pid, &status, 0);
-                return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
-            }
+        case NODE_IF: {
+            int condition = execute_ast(node->children[0]);
+            if (shell_control.flow != CONTROL_NONE) return condition;
+            if (!condition) return execute_ast(node->children[1]);
+            return node->child_count > 2 ? execute_ast(node->children[2]) : 0;
         }
 
-        case NODE_PIPE: {
-            int pipefd[2];
-            if (pipe(pipefd) == -1) {
-                perror("pipe failed");
-                return -1;
-            }
+        case NODE_WHILE:
+        case NODE_UNTIL:
+            return execute_loop(node);
 
-            pid_t pid1 = fork();
-            if (pid1 < 0) {
-                perror("fork failed");
-                close(pipefd[0]);
-                close(pipefd[1]);
-                return -1;
-            }
-            if (!pid1) {
-                close(pipefd[0]);
-                dup2(pipefd[1], STDOUT_FILENO);
-                close(pipefd[1]);
-                exit(execute_ast(node->left));
-            }
+        case NODE_FOR:
+            return execute_for(node);
 
-            pid_t pid2 = fork();
-            if (pid2 < 0) {
-                perror("fork failed");
-                close(pipefd[0]);
-                close(pipefd[1]);
-                return -1;
-            }
-            if (!pid2) {
-                close(pipefd[1]);
-                dup2(pipefd[0], STDIN_FILENO);
-                close(pipefd[0]);
-                exit(execute_ast(node->right));
-            }
+        default:
+            return -1;
+    }
+}
 
-            close(pipefd[0]);
-            close(pipefd[1]);
+static int execute_node(ASTNode *node);
 
-            int status1, status2;
-            waitpid(pid1, &status1, 0);
-            waitpid(pid2, &status2, 0);
-            
-            return WIFEXITED(status2) ? WEXITSTATUS(status2) : -1;
+static char *assignment_name(const char *word) {
+    return arena_strndup(&scratch, word, strchr(word, '=') - word);
+}
+
+/* NAME=value words on their own set shell variables. */
+static int assign_variables(ASTNode *node, int status) {
+    for (int i = 0; i < node->assignments; ++i) {
+        var_set(assignment_name(node->args[i]), strchr(node->args[i], '=') + 1, false);
+    }
+    return status;
+}
+
+/* In front of a command they are exported to that command alone and
+ * restored once it finishes. */
+static int execute_prefixed(ASTNode *node) {
+    int count = node->assignments;
+    char **names = arena_alloc(&scratch, count * sizeof(char *));
+    char **old_values = arena_alloc(&scratch, count * sizeof(char *));
+    bool *exported = arena_alloc(&scratch, count * sizeof(bool));
+
+    for (int i = 0; i < count; ++i) {
+        names[i] = assignment_name(node->args[i]);
+        const char *old = var_get(names[i]);
+        old_values[i] = old ? arena_strdup(&scratch, old) : NULL;
+        exported[i] = var_is_exported(names[i]);
+        var_set(names[i], strchr(node->args[i], '=') + 1, true);
+    }
+
+    ASTNode command = *node;
+    command.args = node->args + count;
+    command.assignments = 0;
+    int status = execute_node(&command);
+
+    for (int i = count - 1; i >= 0; --i) {
+        if (old_values[i]) var_set(names[i], old_values[i], false);
+        else var_unset(names[i]);
+        var_set_exported(names[i], exported[i]);
+    }
+    return status;
+}
+
+/* Hands node to the job scheduler; an interactive shell reports the job. */
+static int execute_background(ASTNode *node) {
+    sigset_t saved;
+    jobs_block(&saved);
+    Job *job = jobs_submit(node);
+    jobs_unblock(&saved);
+
+    if (!job) return 127;
+    if (!shell_interactive) return 0;
+    if (job->state == JOB_QUEUED) output_printf(STDOUT_FILENO, "[%d] queued\n", job->id);
+    else output_printf(STDOUT_FILENO, "[%d] %d\n", job->id, job->procs[0].pid);
+    return 0;
+}
+
+static int execute_node(ASTNode *node) {
+    switch (node->type) {
+        case NODE_COMMAND: {
+            if (node->assignments) return execute_prefixed(node);
+            Function *function = function_find(node->args[0]);
+            if (function) return execute_function(function, node);
+            const Builtin *builtin = find_builtin(node->args[0]);
+            if (builtin) return execute_builtin(builtin, node);
+            return execute_command(node);
         }
+
+        case NODE_PIPE:
+            return execute_pipeline(node);
         
         case NODE_AND: {
             int status1 = execute_ast(node->left);
+            if (shell_control.flow != CONTROL_NONE) return status1;
             if (!status1) {
                 return execute_ast(node->right);
             }
@@ -131,6 +761,7 @@ int execute_ast(ASTNode *node) {
         
         case NODE_OR: {
             int status1 = execute_ast(node->left);
+            if (shell_control.flow != CONTROL_NONE) return status1;
             if (status1) {
                 return execute_ast(node->right);
             }
@@ -138,39 +769,63 @@ int execute_ast(ASTNode *node) {
         }
         
         case NODE_SEQUENCE: {
-            execute_ast(node->left);
-            return execute_ast(node->right);
-        }
-        
-        case NODE_BACKGROUND: {
-            pid_t pid = fork();
-            if (pid < 0) {
-                perror("fork failed");
-                return -1;
-            }
-            if (!pid) {
-                setpgid(0, 0);
-                exit(execute_ast(node->left));
+            if (!node->child_count) {
+                int status = execute_ast(node->left);
+                if (shell_control.flow != CONTROL_NONE || shell_interrupted) return status;
+                return execute_ast(node->right);
             }
 
-            printf("[%d]\n", pid);
-            return 0;
+            int status = 0;
+            for (int i = 0; i < node->child_count; ++i) {
+                status = execute_ast(node->children[i]);
+                if (shell_control.flow != CONTROL_NONE || shell_interrupted) break;
+            }
+            return status;
         }
+        
+        case NODE_BACKGROUND:
+            return execute_background(node->left);
             
         case NODE_SUBSHELL: {
-            pid_t pid = fork();
-            if (pid < 0) {
-                perror("fork failed");
-                return -1;
-            }
+            pid_t pid = fork_child();
+            if (pid < 0) return -1;
             if (!pid) {
-                setpgid(0, 0);
-                exit(execute_ast(node->left));
+                int saved[2];
+                if (shell_interactive) setpgid(0, 0);
+                if (redirect_in_process(node, saved)) execute_exit(1);
+                execute_exit(execute_ast(node->left));
             }
-            
-            int status;
-            waitpid(pid, &status, 0);
-            return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+            if (shell_interactive) setpgid(pid, pid);
+            return wait_foreground(node, shell_interactive ? pid : -1, &pid, 1, NULL);
+        }
+
+        case NODE_GROUP:
+        case NODE_IF:
+        case NODE_WHILE:
+        case NODE_UNTIL:
+        case NODE_FOR: {
+            int saved[2];
+            if (redirect_in_process(node, saved)) return 1;
+            int status = execute_compound(node);
+            undo_redirections(saved);
+            return status;
+        }
+
+        case NODE_FUNCTION:
+            function_define(node->name, node->left);
+            return 0;
+
+        case NODE_GUARD:
+            return execute_ast(unguard(node));
+
+        case NODE_TIME: {
+            Timing timing;
+            TimingSample sample;
+            timing_start(&timing);
+            int status = execute_ast(node->left);
+            timing_stop(&timing, &sample);
+            timing_print(&sample);
+            return status;
         }
 
         default:
@@ -179,37 +834,538 @@ int execute_ast(ASTNode *node) {
     }
 }
 
-void shell_loop() {
-    char input[MAX_COMMAND_LENGTH];
+/* Closes the process substitutions made since there were count of them
+ * and waits for their processes, which see end of file once the shell's
+ * ends are closed. */
+static void finish_processes(int count) {
+    for (int i = count; i < process_count; ++i) close(processes[i].fd);
+    for (int i = count; i < process_count; ++i) {
+        while (waitpid(processes[i].pid, NULL, 0) < 0 && errno == EINTR);
+    }
+    process_count = count;
+}
 
-    printf("Simple Shell (type 'exit' to quit)\n");
+/* Assignments alone, or a command that expanded to nothing, leave the
+ * status of the last substitution in them; captures is the count of
+ * substitutions from before the expansion. */
+static int execute_node_expanded(ASTNode *expanded, unsigned long captures) {
+    if (expanded->type == NODE_COMMAND && !expanded->args[expanded->assignments]) {
+        return assign_variables(expanded, capture_count != captures ? shell_last_status : 0);
+    }
+    return execute_node(expanded);
+}
 
-    while(1) {
-        printf("> ");
-        if (!fgets(input, sizeof(input), stdin)) {
-            printf("\n");
-            break;
+static int execute_expanded(ASTNode *node) {
+    if (!node->expand) return shell_last_status = execute_node(node);
+
+    if (!scratch.head) arena_init(&scratch);
+    ArenaMark mark = arena_mark(&scratch);
+    unsigned long captures = capture_count;
+    int processes_before = process_count;
+    TRACE_BEGIN(span);
+    ASTNode *expanded = expand_node(&scratch, node);
+    TRACE_END(span, "expand", NULL);
+
+    int status = expanded ? execute_node_expanded(expanded, captures) : 1;
+    if (process_count != processes_before) finish_processes(processes_before);
+    arena_restore(&scratch, mark);
+    return shell_last_status = status;
+}
+
+/* set -o timing records every simple command, including its expansions. */
+static int execute_timed(ASTNode *node) {
+    Timing timing;
+    TimingSample sample;
+    timing_start(&timing);
+    int status = execute_expanded(node);
+    timing_stop(&timing, &sample);
+
+    char *text = ast_to_string(node);
+    timing_record("command", -1, text, status, &sample);
+    free(text);
+    return status;
+}
+
+int execute_ast(ASTNode *node) {
+    if (!node) return 0;
+    if (shell_options.timing && node->type == NODE_COMMAND) return execute_timed(node);
+    return execute_expanded(node);
+}
+
+#define PROGRAM_INLINE_LOOPS 8
+#define PROGRAM_INLINE_STAGES 16
+
+/* A loop of a running program: where each round starts, the status of its
+ * last body and, for a for loop, the words still to bind. */
+typedef struct {
+    int start;
+    int status;
+    const char *name;
+    char **words;
+    int next;
+    ArenaMark mark;
+    int processes;
+} LoopFrame;
+
+static bool unwinding(void) {
+    return shell_control.flow != CONTROL_NONE || shell_interrupted;
+}
+
+/* Runs a compiled program. Loop frames and pipeline slots are sized by the
+ * compiler, so nothing is allocated per command beyond what expansion
+ * takes from the scratch arena. */
+int execute_program(const Program *program) {
+    if (!program) return 0;
+
+    LoopFrame inline_frames[PROGRAM_INLINE_LOOPS];
+    pid_t inline_pids[PROGRAM_INLINE_STAGES];
+    LoopFrame *frames = program->max_loops > PROGRAM_INLINE_LOOPS ?
+            malloc(program->max_loops * sizeof(LoopFrame)) : inline_frames;
+    pid_t *pids = program->max_stages > PROGRAM_INLINE_STAGES ?
+            malloc(program->max_stages * sizeof(pid_t)) : inline_pids;
+    LoopFrame *frame = NULL;
+    int depth = 0;
+    Pipeline pipeline;
+    if (!scratch.head) arena_init(&scratch);
+
+    int pc = 0;
+    while (pc < program->length) {
+        const Instruction *instruction = &program->code[pc];
+        int operand = instruction->operand;
+
+        switch (instruction->op) {
+            case OP_SPAWN:
+            case OP_EXEC:
+                execute_ast(PROGRAM_NODE(program, operand));
+                break;
+
+            case OP_PIPE:
+                if (instruction->flags & PIPE_FIRST) pipeline_begin(&pipeline, pids);
+                pipeline_launch(&pipeline, PROGRAM_NODE(program, operand), instruction->flags & PIPE_LAST);
+                pc++;
+                continue;
+
+            case OP_WAIT:
+                shell_last_status = pipeline_wait(&pipeline, PROGRAM_NODE(program, operand));
+                break;
+
+            case OP_BG:
+                shell_last_status = execute_background(PROGRAM_NODE(program, operand));
+                break;
+
+            case OP_JUMP:
+                pc = operand;
+                continue;
+
+            case OP_GUARD:
+                pc = is_shadowed(PROGRAM_NODE(program, operand)->args) ? pc + 1 : pc + 2;
+                continue;
+
+            case OP_JUMP_IF_FAIL:
+                pc = shell_last_status ? operand : pc + 1;
+                continue;
+
+            case OP_JUMP_IF_OK:
+                pc = shell_last_status ? pc + 1 : operand;
+                continue;
+
+            case OP_STATUS:
+                shell_last_status = operand;
+                pc++;
+                continue;
+
+            case OP_LOOP_ENTER:
+            case OP_FOR_ENTER:
+                frame = &frames[depth++];
+                frame->start = pc + 1;
+                frame->status = 0;
+                frame->mark = arena_mark(&scratch);
+                frame->processes = process_count;
+                frame->name = NULL;
+                frame->words = NULL;
+                frame->next = 0;
+                if (instruction->op == OP_FOR_ENTER) {
+                    ASTNode *loop = expand_node(&scratch, PROGRAM_NODE(program, operand));
+                    if (loop) {
+                        frame->name = loop->name;
+                        frame->words = loop->args ? loop->args : positional_words();
+                    }
+                    else frame->status = 1;
+                }
+                shell_control.loop_depth++;
+                pc++;
+                continue;
+
+            case OP_FOR_NEXT:
+                if (!frame->words || !frame->words[frame->next]) {
+                    pc = operand;
+                    continue;
+                }
+                var_set(frame->name, frame->words[frame->next++], false);
+                pc++;
+                continue;
+
+            /* The condition's own break, continue or return is taken as it
+             * would be after the body. */
+            case OP_LOOP_TEST:
+                if (unwinding()) pc = loop_interrupted() ? operand : frame->start;
+                else if ((shell_last_status == 0) != !(instruction->flags & LOOP_UNTIL)) pc = operand;
+                else pc++;
+                continue;
+
+            case OP_LOOP_NEXT:
+                frame->status = shell_last_status;
+                pc = loop_interrupted() ? operand : frame->start;
+                continue;
+
+            case OP_LOOP_EXIT:
+                if (process_count != frame->processes) finish_processes(frame->processes);
+                arena_restore(&scratch, frame->mark);
+                shell_control.loop_depth--;
+                shell_last_status = frame->status;
+                depth--;
+                frame = depth ? &frames[depth - 1] : NULL;
+                break;
+        }
+        pc = unwinding() ? instruction->unwind : pc + 1;
+    }
+
+    if (frames != inline_frames) free(frames);
+    if (pids != inline_pids) free(pids);
+    return shell_last_status;
+}
+
+/* Builtins that only write to stdout; substitutions of them run inside the
+ * shell with stdout going to memory. */
+static bool is_capture_builtin(ASTNode *node) {
+    static const char *const names[] = { "[", "echo", "false", "printf", "pwd", "test", "true" };
+    if (node->type != NODE_COMMAND || !node->args[0] || node->input_file || node->here_text || node->output_file) {
+        return false;
+    }
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        if (!strcmp(node->args[0], names[i])) return !function_find(names[i]);
+    }
+    return false;
+}
+
+static void capture_builtin(ASTNode *node, char **output, size_t *size) {
+    output_capture_begin(STDOUT_FILENO);
+    shell_last_status = find_builtin(node->args[0])->func(node->args);
+    output_capture_end(STDOUT_FILENO, output, size);
+}
+
+static void capture_child(ASTNode *node, char **output, size_t *size) {
+    int pipefd[2];
+    if (open_pipe(pipefd)) {
+        perror("pipe failed");
+        shell_last_status = 1;
+        return;
+    }
+
+    pid_t pid = fork_child();
+    if (pid < 0) {
+        close(pipefd[0]);
+        close(pipefd[1]);
+        shell_last_status = 1;
+        return;
+    }
+    if (!pid) {
+        close(pipefd[0]);
+        dup2(pipefd[1], STDOUT_FILENO);
+        close(pipefd[1]);
+        execute_exit(execute_ast(node));
+    }
+    close(pipefd[1]);
+
+    size_t capacity = 0;
+    while (1) {
+        if (*size == capacity) {
+            capacity = capacity ? capacity * 2 : 4096;
+            *output = realloc(*output, capacity);
+        }
+        ssize_t n = read(pipefd[0], *output + *size, capacity - *size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        *size += n;
+    }
+    close(pipefd[0]);
+
+    int raw;
+    struct rusage usage;
+    TRACE_BEGIN(span);
+    while (wait4(pid, &raw, 0, &usage) < 0) {
+        if (errno != EINTR) {
+            shell_last_status = 127;
+            return;
+        }
+    }
+    TRACE_END(span, "wait", NULL);
+    timing_child(&usage);
+    if (WIFSIGNALED(raw) && WTERMSIG(raw) == SIGINT) shell_interrupted = 1;
+    shell_last_status = wait_status(raw);
+}
+
+/* Parses the body of a substitution into arena. Returns false after
+ * reporting a syntax error; an empty body leaves *ast NULL. */
+static bool parse_substitution(Arena *arena, const char *text, size_t length, ASTNode **ast) {
+    TRACE_BEGIN(span);
+    TokenArray *tokens = tokenize(arena, arena_strndup(arena, text, length));
+    TRACE_END(span, "tokenize", tokens->input);
+    TRACE_BEGIN(parse_span);
+    *ast = tokens->error.type == LEX_OK ? parse_expression(tokens) : NULL;
+    TRACE_END(parse_span, "parse", NULL);
+
+    if (tokens->error.type != LEX_OK || tokens->parse_error) {
+        if (tokens->error.type != LEX_OK) print_lex_error(tokens);
+        else print_parse_error(tokens);
+        shell_last_status = 2;
+        return false;
+    }
+    if (*ast && shell_options.optimize) {
+        TRACE_BEGIN(optimize_span);
+        *ast = optimize_ast(arena, *ast);
+        TRACE_END(optimize_span, "optimize", NULL);
+    }
+    return true;
+}
+
+/* Runs the body of a command substitution and returns its output, stored
+ * in arena. A lone capture builtin runs in the shell; anything else runs in
+ * a forked shell whose stdout is read through a pipe. */
+char *execute_capture(Arena *arena, const char *text, size_t length, size_t *captured) {
+    ArenaMark mark = arena_mark(arena);
+    capture_count++;
+    ASTNode *ast;
+    char *output = NULL;
+    size_t size = 0;
+
+    if (!parse_substitution(arena, text, length, &ast)) ast = NULL;
+    else if (ast) {
+        /* Expanded once here so the child does not repeat substitutions. */
+        if (ast->type == NODE_COMMAND) ast = expand_node(arena, ast);
+        if (!ast) shell_last_status = 1;
+        else if (is_capture_builtin(ast)) capture_builtin(ast, &output, &size);
+        else capture_child(ast, &output, &size);
+    }
+    else shell_last_status = 0;
+
+    arena_restore(arena, mark);
+    char *result = arena_strndup(arena, output ? output : "", size);
+    free(output);
+    *captured = size;
+    return result;
+}
+
+/* Starts the body of <(LIST) or >(LIST) in a forked shell connected to a
+ * pipe, and returns the /dev/fd path of the shell's end, stored in arena.
+ * The descriptor is inherited by the command that names it and closed,
+ * and the process waited for, once that command is done. */
+char *execute_process(Arena *arena, const char *text, size_t length, bool reading) {
+    ArenaMark mark = arena_mark(arena);
+    ASTNode *ast;
+    if (!parse_substitution(arena, text, length, &ast)) return NULL;
+
+    int pipefd[2];
+    if (open_pipe(pipefd)) {
+        perror("pipe failed");
+        arena_restore(arena, mark);
+        return NULL;
+    }
+    int own = reading ? pipefd[0] : pipefd[1];
+    int other = reading ? pipefd[1] : pipefd[0];
+
+    pid_t pid = fork_child();
+    if (!pid) {
+        for (int i = 0; i < process_count; ++i) close(processes[i].fd);
+        dup2(other, reading ? STDOUT_FILENO : STDIN_FILENO);
+        close(other);
+        close(own);
+        execute_exit(execute_ast(ast));
+    }
+    arena_restore(arena, mark);
+    close(other);
+    if (pid < 0) {
+        close(own);
+        return NULL;
+    }
+
+    fcntl(own, F_SETFD, 0);
+    if (process_count == process_capacity) {
+        process_capacity = process_capacity ? process_capacity * 2 : 4;
+        processes = realloc(processes, process_capacity * sizeof(ProcessSubstitution));
+    }
+    processes[process_count].fd = own;
+    processes[process_count++].pid = pid;
+
+    char path[32];
+    snprintf(path, sizeof(path), "/dev/fd/%d", own);
+    return arena_strdup(arena, path);
+}
+
+
+typedef struct {
+    char *text;
+    size_t length;
+    size_t capacity;
+} CommandText;
+
+static void command_append(CommandText *command, const char *text, size_t length) {
+    if (command->length + length + 1 > command->capacity) {
+        while (command->length + length + 1 > command->capacity) {
+            command->capacity = command->capacity ? command->capacity * 2 : 256;
+        }
+        command->text = realloc(command->text, command->capacity);
+    }
+    memcpy(command->text + command->length, text, length);
+    command->length += length;
+    command->text[command->length] = '\0';
+}
+
+static ASTNode *optimize_tree(Arena *arena, ASTNode *ast) {
+    if (shell_options.astdebug) {
+        output_puts(STDOUT_FILENO, "AST before optimization:\n");
+        print_ast(ast, 1);
+    }
+    ast = optimize_ast(arena, ast);
+    if (shell_options.astdebug) {
+        output_puts(STDOUT_FILENO, "AST after optimization:\n");
+        print_ast(ast, 1);
+    }
+    return ast;
+}
+
+/* Compiles a complete command, into its cache entry when it gets one. With
+ * set +o compile the tree is run as it is, and not cached. */
+static Program *compile_command(Arena *arena, const CommandText *command, ASTNode *ast) {
+    TRACE_BEGIN(span);
+    Program *program = NULL;
+    if (!shell_options.compile) program = compile_tree(arena, ast);
+    else {
+        program = ast_cache_insert(command->text, command->length, shell_options.optimize, ast);
+        if (!program) program = compile_ast(arena, ast);
+    }
+    TRACE_END(span, "compile", NULL);
+    if (program && shell_options.astdebug) print_program(program);
+    return program;
+}
+
+static bool ends_with_backslash(const CommandText *command) {
+    size_t count = 0;
+    while (count < command->length && command->text[command->length - 1 - count] == '\\') count++;
+    return count % 2;
+}
+
+/* Reads lines until they form a complete command, which is left compiled
+ * in *program.
+ * Lines ending in a backslash, an open quote or subshell, or a trailing
+ * operator continue on the next line. Returns false at end of input. */
+static bool read_command(Input *input, CommandText *command, Arena *arena, bool prompt, Program **program) {
+    const char *line;
+    size_t length;
+
+    command->length = 0;
+    *program = NULL;
+    while (1) {
+        if (prompt) {
+            output_puts(STDOUT_FILENO, "> ");
+            output_flush_all();
+        }
+        bool eof = !input_read_line(input, &line, &length);
+        if (eof && !command->length) return false;
+        if (!eof) command_append(command, line, length);
+        if (!command->text) command_append(command, "", 0);
+
+        if (!eof && ends_with_backslash(command)) {
+            command->text[--command->length] = '\0';
+            continue;
         }
 
-        input[strcspn(input, "\n")] = '\0';
-        TokenArray *tokens = tokenize(input);
-        ASTNode *ast = parse_expression(tokens);
+        /* Repeated lines reuse the program compiled the first time. */
+        if (shell_options.compile) {
+            *program = ast_cache_lookup(command->text, command->length, shell_options.optimize);
+            if (*program) return true;
+        }
+
+        ASTNode *ast = NULL;
+        arena_reset(arena);
+        TRACE_BEGIN(span);
+        TokenArray *tokens = tokenize(arena, command->text);
+        TRACE_END(span, "tokenize", command->text);
+        TRACE_BEGIN(parse_span);
+        if (tokens->error.type == LEX_OK) ast = parse_expression(tokens);
+        TRACE_END(parse_span, "parse", NULL);
+        if (tokens->incomplete && !eof) {
+            command_append(command, "\n", 1);
+            continue;
+        }
 
-        if (ast) {
-            if (ast->args && !strcmp("exit", ast->args[0])) {
-                free_ast(ast);
-                free_token_array(tokens);
-                execute_exit(0);
+        if (tokens->error.type != LEX_OK) print_lex_error(tokens);
+        else if (tokens->parse_error) print_parse_error(tokens);
+        else {
+            if (ast && shell_options.optimize) {
+                TRACE_BEGIN(optimize_span);
+                ast = optimize_tree(arena, ast);
+                TRACE_END(optimize_span, "optimize", NULL);
             }
-            execute_ast(ast);
-            free_ast(ast);
+            *program = compile_command(arena, command, ast);
+            return true;
         }
 
-        free_token_array(tokens);
+        /* A syntax error ends a script; an interactive shell carries on. */
+        if (!shell_interactive) execute_exit(2);
+        shell_last_status = 2;
+        return true;
     }
 }
 
-int main() {
-    shell_loop();
-    return 0;
-}
\ No newline at end of file
+static void interrupt_handler(int sig) {
+    (void)sig;
+    shell_interrupted = 1;
+}
+
+int shell_loop(Input *input) {
+    CommandText command = { NULL, 0, 0 };
+    Arena arena;
+    arena_init(&arena);
+
+    bool prompt = input->fd == STDIN_FILENO && isatty(STDIN_FILENO);
+    shell_interactive = prompt && tcgetpgrp(STDIN_FILENO) == getpgrp();
+    if (shell_interactive) {
+        for (int i = 0; i < JOB_CONTROL_SIGNAL_COUNT; ++i) signal(job_control_signals[i], SIG_IGN);
+
+        /* Ctrl-C while the shell itself runs a loop has to stop it. */
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = interrupt_handler;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        sigaction(SIGINT, &action, NULL);
+    }
+    jobs_init();
+
+    if (prompt) output_puts(STDOUT_FILENO, "Simple Shell (type 'exit' to quit)\n");
+
+    Program *program;
+    while (1) {
+        jobs_notify(shell_interactive);
+        if (!read_command(input, &command, &arena, prompt, &program)) {
+            if (prompt) output_putc(STDOUT_FILENO, '\n');
+            break;
+        }
+
+        if (program) {
+            shell_interrupted = 0;
+            input_release(input);
+            TRACE_BEGIN(span);
+            execute_program(program);
+            TRACE_END(span, "execute", command.text);
+            input_reclaim(input);
+        }
+    }
+
+    jobs_drain();
+    output_flush_all();
+    free(command.text);
+    arena_free(&arena);
+    return shell_last_status;
+}
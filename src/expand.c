@@ -0,0 +1,516 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include "expand.h"
+#include "executor.h"
+#include "jobs.h"
+#include "lexer.h"
+#include "pathglob.h"
+#include "scan.h"
+#include "variables.h"
+
+#define DEFAULT_IFS " \t\n"
+
+typedef struct {
+    Arena *arena;
+    bool split;
+    const char *ifs;
+    char *field;
+    size_t length;
+    size_t capacity;
+    /* A quoted empty string still makes a field. */
+    bool has_field;
+    bool had_field_before_quote;
+    bool after_space;
+    /* The field as a pathname pattern, with quoted '*', '?', '[' and '\\'
+     * escaped; glob is set once an unquoted one appears. */
+    char *pattern;
+    size_t pattern_length;
+    size_t pattern_capacity;
+    bool glob;
+    char **fields;
+    int count;
+    int fields_capacity;
+    /* Set once an error was reported; nothing more is expanded. */
+    bool failed;
+} Expansion;
+
+static void pattern_append(Expansion *expansion, const char *text, size_t length, bool literal) {
+    if (expansion->pattern_length + 2 * length + 1 > expansion->pattern_capacity) {
+        while (expansion->pattern_length + 2 * length + 1 > expansion->pattern_capacity) {
+            expansion->pattern_capacity = expansion->pattern_capacity ? expansion->pattern_capacity * 2 : 64;
+        }
+        expansion->pattern = realloc(expansion->pattern, expansion->pattern_capacity);
+    }
+    for (size_t i = 0; i < length; ++i) {
+        bool magic = (scan_class[(unsigned char)text[i]] & SCAN_GLOB) || text[i] == '\\';
+        if (magic && literal) expansion->pattern[expansion->pattern_length++] = '\\';
+        else if (magic) expansion->glob = true;
+        expansion->pattern[expansion->pattern_length++] = text[i];
+    }
+}
+
+/* Adds text to the current field. literal text came from quotes and is
+ * never a pattern. */
+static void field_append(Expansion *expansion, const char *text, size_t length, bool literal) {
+    if (expansion->split && !shell_options.noglob) pattern_append(expansion, text, length, literal);
+    if (expansion->length + length + 1 > expansion->capacity) {
+        while (expansion->length + length + 1 > expansion->capacity) {
+            expansion->capacity = expansion->capacity ? expansion->capacity * 2 : 64;
+        }
+        expansion->field = realloc(expansion->field, expansion->capacity);
+    }
+    memcpy(expansion->field + expansion->length, text, length);
+    expansion->length += length;
+    expansion->has_field = true;
+    expansion->after_space = false;
+}
+
+static void field_push(Expansion *expansion, char *field) {
+    if (expansion->count + 1 >= expansion->fields_capacity) {
+        expansion->fields_capacity = expansion->fields_capacity ? expansion->fields_capacity * 2 : 8;
+        expansion->fields = realloc(expansion->fields, expansion->fields_capacity * sizeof(char *));
+    }
+    expansion->fields[expansion->count++] = field;
+}
+
+/* Finishes the current field. A field with an unquoted pattern becomes the
+ * sorted pathnames it matches, or stays as it is when there are none. */
+static void field_end(Expansion *expansion) {
+    if (!expansion->has_field) return;
+
+    char **matches;
+    int count = 0;
+    if (expansion->glob) {
+        expansion->pattern[expansion->pattern_length] = '\0';
+        count = path_glob(expansion->arena, expansion->pattern, &matches);
+    }
+    for (int i = 0; i < count; ++i) field_push(expansion, matches[i]);
+    if (!count) {
+        field_push(expansion, arena_strndup(expansion->arena, expansion->field ? expansion->field : "",
+                expansion->length));
+    }
+    expansion->length = 0;
+    expansion->pattern_length = 0;
+    expansion->glob = false;
+    expansion->has_field = false;
+}
+
+/* Splits an unquoted expansion on IFS. Runs of IFS whitespace separate
+ * fields; every other IFS character ends one, possibly empty. */
+static void field_split(Expansion *expansion, const char *text, size_t length) {
+    if (!expansion->split) {
+        field_append(expansion, text, length, false);
+        return;
+    }
+
+    size_t start = 0;
+    for (size_t i = 0; i < length; ++i) {
+        if (!strchr(expansion->ifs, text[i]) || !text[i]) continue;
+        if (i > start) field_append(expansion, text + start, i - start, false);
+        start = i + 1;
+
+        bool space = text[i] == ' ' || text[i] == '\t' || text[i] == '\n';
+        if (space) {
+            bool had_field = expansion->has_field;
+            field_end(expansion);
+            if (had_field) expansion->after_space = true;
+        }
+        else if (expansion->after_space) expansion->after_space = false;
+        else {
+            expansion->has_field = true;
+            field_end(expansion);
+        }
+    }
+    if (start < length) field_append(expansion, text + start, length - start, false);
+}
+
+/* Runs a substitution body and adds its output without trailing newlines. */
+static void substitute(Expansion *expansion, const char *text, size_t length, bool quoted) {
+    size_t captured;
+    char *output = execute_capture(expansion->arena, text, length, &captured);
+    while (captured && output[captured - 1] == '\n') captured--;
+
+    if (quoted) field_append(expansion, output, captured, true);
+    else field_split(expansion, output, captured);
+}
+
+/* Inside backquotes a backslash only escapes '$', '`' and '\'. */
+static void substitute_backquoted(Expansion *expansion, const char *text, size_t length, bool quoted) {
+    char *body = arena_alloc(expansion->arena, length + 1);
+    size_t body_length = 0;
+    for (size_t i = 0; i < length; ++i) {
+        if (text[i] == '\\' && i + 1 < length && strchr("$`\\", text[i + 1])) i++;
+        body[body_length++] = text[i];
+    }
+    body[body_length] = '\0';
+    substitute(expansion, body, body_length, quoted);
+}
+
+static void expand_into(Expansion *expansion, const char *word, bool quoted);
+
+static void add_value(Expansion *expansion, const char *value, size_t length, bool quoted) {
+    if (quoted) field_append(expansion, value, length, true);
+    else field_split(expansion, value, length);
+}
+
+/* $@ and $*: each positional parameter is a field of its own, except in
+ * "$*", which joins them with the first character of IFS, and where no
+ * splitting happens, which joins them with spaces. "$@" with no parameters
+ * makes no field at all. */
+static void expand_positional(Expansion *expansion, bool quoted, bool at) {
+    if (quoted && at && !shell_params.count) {
+        expansion->has_field = expansion->had_field_before_quote || expansion->length;
+        return;
+    }
+
+    bool separate = expansion->split && (at || !quoted);
+    for (int i = 0; i < shell_params.count; ++i) {
+        if (i > 0 && separate) {
+            expansion->has_field = true;
+            field_end(expansion);
+        }
+        else if (i > 0 && (!quoted || at)) field_append(expansion, " ", 1, true);
+        else if (i > 0 && *expansion->ifs) field_append(expansion, expansion->ifs, 1, true);
+        add_value(expansion, shell_params.values[i], strlen(shell_params.values[i]), quoted);
+    }
+}
+
+/* Special and positional parameters, then variables. NULL when unset;
+ * number is scratch space for numeric values. */
+static const char *parameter_value(const char *name, size_t length, char *number, size_t size) {
+    if (length == 1) {
+        switch (name[0]) {
+            case '?':
+                snprintf(number, size, "%d", shell_last_status);
+                return number;
+            case '$':
+                snprintf(number, size, "%d", (int)shell_pid);
+                return number;
+            case '!':
+                if (!jobs_last_pid()) return NULL;
+                snprintf(number, size, "%d", (int)jobs_last_pid());
+                return number;
+            case '#':
+                snprintf(number, size, "%d", shell_params.count);
+                return number;
+            case '0':
+                return shell_params.name;
+        }
+    }
+    if (isdigit((unsigned char)name[0])) {
+        int index = atoi(name);
+        if (!index) return shell_params.name;
+        return index <= shell_params.count ? shell_params.values[index - 1] : NULL;
+    }
+    return var_lookup(name, length);
+}
+
+/* Length of the parameter name at name: a variable, a run of digits (only
+ * inside braces) or one special character. */
+static size_t parameter_name(const char *name, bool braced) {
+    size_t length = 0;
+    if (isalpha((unsigned char)name[0]) || name[0] == '_') {
+        while (isalnum((unsigned char)name[length]) || name[length] == '_') length++;
+        return length;
+    }
+    if (isdigit((unsigned char)name[0])) {
+        if (!braced) return 1;
+        while (isdigit((unsigned char)name[length])) length++;
+        return length;
+    }
+    return name[0] && strchr("?$!#@*", name[0]) ? 1 : 0;
+}
+
+/* ${NAME}, ${#NAME} and ${NAME op word} for op in - = + with or without a
+ * leading ':', which makes an empty value count as unset. */
+static void expand_braced(Expansion *expansion, const char *body, bool quoted) {
+    char number[24];
+    bool length_of = body[0] == '#' && body[1];
+    const char *name = body + length_of;
+    size_t name_length = parameter_name(name, true);
+    const char *op = name + name_length;
+
+    bool colon = *op == ':';
+    char kind = op[colon];
+    if (!name_length || (length_of && *op) || (*op && (!kind || !strchr("-=+", kind)))) {
+        fprintf(stderr, "${%s}: bad substitution\n", body);
+        expansion->failed = true;
+        return;
+    }
+
+    bool positional = name_length == 1 && (*name == '@' || *name == '*');
+    if (positional && !*op && !length_of) {
+        expand_positional(expansion, quoted, *name == '@');
+        return;
+    }
+
+    const char *value = positional ? (shell_params.count ? shell_params.values[0] : NULL) :
+            parameter_value(name, name_length, number, sizeof(number));
+    if (length_of) {
+        snprintf(number, sizeof(number), "%zu", value ? strlen(value) : 0);
+        add_value(expansion, number, strlen(number), quoted);
+        return;
+    }
+
+    bool use_value = value && (!colon || *value);
+    const char *word = op + colon + 1;
+    switch (*op ? kind : 0) {
+        case '-':
+            if (use_value) break;
+            expand_into(expansion, word, quoted);
+            return;
+        case '+':
+            if (use_value) expand_into(expansion, word, quoted);
+            return;
+        case '=':
+            if (use_value) break;
+            value = expand_word(expansion->arena, word);
+            if (!value) {
+                expansion->failed = true;
+                return;
+            }
+            if (isdigit((unsigned char)*name) || (name_length == 1 && strchr("?$!#@*", *name))) {
+                fprintf(stderr, "$%.*s: cannot assign in this way\n", (int)name_length, name);
+                expansion->failed = true;
+                return;
+            }
+            char *variable = arena_strndup(expansion->arena, name, name_length);
+            var_set(variable, value, false);
+            break;
+    }
+    if (value) add_value(expansion, value, strlen(value), quoted);
+}
+
+/* Expands the parameter at word[i], which is a '$', and returns the index
+ * after it. A '$' that starts no parameter stays as it is. */
+static int expand_parameter(Expansion *expansion, const char *word, int i, int length, bool quoted) {
+    char number[24];
+
+    if (word[i + 1] == '{') {
+        int end = lexer_brace_end(word, i, length);
+        if (end < 0) end = length + 1;
+        expand_braced(expansion, arena_strndup(expansion->arena, word + i + 2, end - i - 3), quoted);
+        return end;
+    }
+
+    const char *name = word + i + 1;
+    size_t name_length = parameter_name(name, false);
+    if (!name_length) {
+        field_append(expansion, "$", 1, true);
+        return i + 1;
+    }
+    if (name_length == 1 && (*name == '@' || *name == '*')) expand_positional(expansion, quoted, *name == '@');
+    else {
+        const char *value = parameter_value(name, name_length, number, sizeof(number));
+        if (value) add_value(expansion, value, strlen(value), quoted);
+    }
+    return i + 1 + name_length;
+}
+
+static void expand_into(Expansion *expansion, const char *word, bool quoted) {
+    int length = strlen(word);
+    int i = 0;
+
+    while (i < length && !expansion->failed) {
+        char c = word[i];
+        if (c == '\'' && !quoted) {
+            const char *end = strchr(word + i + 1, '\'');
+            int close = end ? end - word : length;
+            field_append(expansion, word + i + 1, close - i - 1, true);
+            i = close + 1;
+        }
+        else if (c == '"') {
+            quoted = !quoted;
+            if (quoted) {
+                expansion->had_field_before_quote = expansion->has_field;
+                expansion->has_field = true;
+            }
+            i++;
+        }
+        else if (c == '\\' && i + 1 < length) {
+            if (quoted && !strchr("\"\\$`", word[i + 1])) field_append(expansion, word + i, 2, true);
+            else field_append(expansion, word + i + 1, 1, true);
+            i += 2;
+        }
+        else if (c == '$' && word[i + 1] == '(') {
+            int end = lexer_substitution_end(word, i, length);
+            if (end < 0) end = length + 1;
+            substitute(expansion, word + i + 2, end - i - 3, quoted);
+            i = end;
+        }
+        else if (c == '$') i = expand_parameter(expansion, word, i, length, quoted);
+        else if ((c == '<' || c == '>') && word[i + 1] == '(' && !quoted) {
+            int end = lexer_substitution_end(word, i, length);
+            if (end < 0) end = length + 1;
+            const char *path = execute_process(expansion->arena, word + i + 2, end - i - 3, c == '<');
+            if (path) field_append(expansion, path, strlen(path), true);
+            i = end;
+        }
+        else if (c == '`') {
+            int end = lexer_backquote_end(word, i, length);
+            if (end < 0) end = length + 1;
+            substitute_backquoted(expansion, word + i + 1, end - i - 2, quoted);
+            i = end;
+        }
+        else {
+            int start = i++;
+            while (i < length && !(scan_class[(unsigned char)word[i]] & (SCAN_OPERATOR | SCAN_QUOTE | SCAN_EXPAND))) i++;
+            field_append(expansion, word + start, i - start, quoted);
+        }
+    }
+}
+
+static bool is_plain(const char *word) {
+    for (; *word; ++word) {
+        if (scan_class[(unsigned char)*word] & (SCAN_OPERATOR | SCAN_QUOTE | SCAN_EXPAND | SCAN_GLOB)) return false;
+    }
+    return true;
+}
+
+static void expansion_init(Expansion *expansion, Arena *arena, bool split) {
+    memset(expansion, 0, sizeof(*expansion));
+    expansion->arena = arena;
+    expansion->split = split;
+    expansion->ifs = var_get("IFS");
+    if (!expansion->ifs) expansion->ifs = DEFAULT_IFS;
+}
+
+/* Expands a NULL-terminated word list into fields. The first assignments
+ * words are NAME=value and make exactly one field each. Words without
+ * quotes or expansions are passed through as they are. Returns NULL if an
+ * expansion failed. */
+static char **expand_list(Arena *arena, char **words, int assignments) {
+    Expansion expansion;
+    expansion_init(&expansion, arena, true);
+
+    for (int i = 0; words[i] && !expansion.failed; ++i) {
+        if (is_plain(words[i])) {
+            field_push(&expansion, words[i]);
+            continue;
+        }
+        expansion.split = i >= assignments;
+        expand_into(&expansion, words[i], false);
+        field_end(&expansion);
+    }
+
+    char **fields = NULL;
+    if (!expansion.failed) {
+        fields = arena_alloc(arena, (expansion.count + 1) * sizeof(char *));
+        if (expansion.count) memcpy(fields, expansion.fields, expansion.count * sizeof(char *));
+        fields[expansion.count] = NULL;
+    }
+    free(expansion.fields);
+    free(expansion.field);
+    free(expansion.pattern);
+    return fields;
+}
+
+char **expand_words(Arena *arena, char **words) {
+    return expand_list(arena, words, 0);
+}
+
+/* Expands a word that must stay one field, such as a redirection target.
+ * Returns NULL if an expansion failed. */
+char *expand_word(Arena *arena, const char *word) {
+    if (is_plain(word)) return (char *)word;
+
+    Expansion expansion;
+    expansion_init(&expansion, arena, false);
+    expand_into(&expansion, word, false);
+    char *result = expansion.failed ? NULL :
+            arena_strndup(arena, expansion.field ? expansion.field : "", expansion.length);
+    free(expansion.fields);
+    free(expansion.field);
+    return result;
+}
+
+/* Expands a here-document body much like a double-quoted word whose quotes
+ * are ordinary characters: parameters and substitutions, with a backslash
+ * escaping only '$', '`', '\' and a newline. */
+char *expand_here(Arena *arena, const char *text) {
+    Expansion expansion;
+    expansion_init(&expansion, arena, false);
+    int length = strlen(text);
+    int i = 0;
+
+    while (i < length && !expansion.failed) {
+        char c = text[i];
+        if (c == '\\' && i + 1 < length && strchr("$`\\\n", text[i + 1])) {
+            if (text[i + 1] != '\n') field_append(&expansion, text + i + 1, 1, true);
+            i += 2;
+        }
+        else if (c == '$' && text[i + 1] == '(') {
+            int end = lexer_substitution_end(text, i, length);
+            if (end < 0) end = length + 1;
+            substitute(&expansion, text + i + 2, end - i - 3, true);
+            i = end;
+        }
+        else if (c == '$') i = expand_parameter(&expansion, text, i, length, true);
+        else if (c == '`') {
+            int end = lexer_backquote_end(text, i, length);
+            if (end < 0) end = length + 1;
+            substitute_backquoted(&expansion, text + i + 1, end - i - 2, true);
+            i = end;
+        }
+        else {
+            int start = i++;
+            while (i < length && text[i] != '\\' && text[i] != '$' && text[i] != '`') i++;
+            field_append(&expansion, text + start, i - start, true);
+        }
+    }
+
+    char *result = expansion.failed ? NULL :
+            arena_strndup(arena, expansion.field ? expansion.field : "", expansion.length);
+    free(expansion.fields);
+    free(expansion.field);
+    return result;
+}
+
+static bool word_is_pure(const char *word) {
+    for (const char *p = word; *p; ++p) {
+        if (*p == '`' || ((*p == '$' || *p == '<' || *p == '>') && p[1] == '(')) return false;
+        if (*p == '$' && p[1] == '{') {
+            const char *op = p + 2 + parameter_name(p + 2, true);
+            if (op[*op == ':'] == '=') return false;
+        }
+    }
+    return true;
+}
+
+/* Whether expanding node only reads the shell's state: no command or
+ * process substitution, which would run with the shell's descriptors, and
+ * no ${NAME=word}. Quoted text is not told apart, so the answer errs
+ * towards false. */
+bool expand_is_pure(ASTNode *node) {
+    for (int i = 0; node->args && node->args[i]; ++i) {
+        if (!word_is_pure(node->args[i])) return false;
+    }
+    if (node->input_file && !word_is_pure(node->input_file)) return false;
+    if (node->output_file && !word_is_pure(node->output_file)) return false;
+    if (node->here == HERE_DOCUMENT || node->here == HERE_STRING) return word_is_pure(node->here_text);
+    return true;
+}
+
+/* Returns a copy of node with its words expanded, or node itself when none
+ * of them needs it. Children are expanded when they run. Returns NULL once
+ * an expansion failed; the error has been reported. */
+ASTNode *expand_node(Arena *arena, ASTNode *node) {
+    if (!node->expand) return node;
+
+    ASTNode *copy = arena_alloc(arena, sizeof(ASTNode));
+    *copy = *node;
+    copy->expand = false;
+    if (node->args && !(copy->args = expand_list(arena, node->args, node->assignments))) return NULL;
+    if (node->input_file && !(copy->input_file = expand_word(arena, node->input_file))) return NULL;
+    if (node->here == HERE_DOCUMENT) {
+        copy->here_text = expand_here(arena, node->here_text);
+        copy->here = HERE_LITERAL;
+    }
+    else if (node->here == HERE_STRING) copy->here_text = expand_word(arena, node->here_text);
+    if (node->here_text && !copy->here_text) return NULL;
+    if (node->output_file && !(copy->output_file = expand_word(arena, node->output_file))) return NULL;
+    return copy;
+}
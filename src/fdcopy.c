@@ -0,0 +1,223 @@
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include "fdcopy.h"
+#include "executor.h"
+
+static bool is_pipe(int fd) {
+    struct stat st;
+    return !fstat(fd, &st) && S_ISFIFO(st.st_mode);
+}
+
+static bool is_regular(int fd) {
+    struct stat st;
+    return !fstat(fd, &st) && S_ISREG(st.st_mode);
+}
+
+/* The kernel rejects some pairings only at the first call (O_APPEND
+ * outputs, file systems without support); those fall back to copying. */
+static bool unsupported(int error) {
+    return error == EINVAL || error == ENOSYS || error == EXDEV || error == EBADF ||
+            error == EOPNOTSUPP || error == ESPIPE;
+}
+
+/* Interrupted calls are retried unless SIGINT reached the shell, which then
+ * ends the copy with EINTR. */
+static bool retry(ssize_t n) {
+    return n < 0 && errno == EINTR && !shell_interrupted;
+}
+
+static bool interrupted(void) {
+    if (!shell_interrupted) return false;
+    errno = EINTR;
+    return true;
+}
+
+static ssize_t write_all(int fd, const char *data, size_t length) {
+    size_t written = 0;
+    while (written < length) {
+        ssize_t n = write(fd, data + written, length - written);
+        if (retry(n)) continue;
+        if (n < 0) return -1;
+        written += n;
+    }
+    return written;
+}
+
+/* Copies at most limit bytes (-1 for no limit) through a buffer. */
+static ssize_t copy_buffered(int in, int out, ssize_t limit) {
+    char buffer[FD_COPY_BUFFER];
+    ssize_t total = 0;
+
+    while (limit < 0 || total < limit) {
+        if (interrupted()) return -1;
+        size_t want = sizeof(buffer);
+        if (limit >= 0 && (size_t)(limit - total) < want) want = limit - total;
+
+        ssize_t n = read(in, buffer, want);
+        if (retry(n)) continue;
+        if (n < 0) return -1;
+        if (n == 0) break;
+        if (write_all(out, buffer, n) < 0) return -1;
+        total += n;
+    }
+    return total;
+}
+
+/* Returns bytes moved, or -1. *fallback is set when nothing was moved
+ * because the kernel does not support this pairing. */
+static ssize_t copy_kernel(int in, int out, bool *fallback) {
+    bool pipes = is_pipe(in) || is_pipe(out);
+    bool files = is_regular(in) && is_regular(out);
+    ssize_t total = 0;
+
+    *fallback = false;
+    if (!pipes && !is_regular(in)) {
+        *fallback = true;
+        return 0;
+    }
+
+    while (1) {
+        if (interrupted()) return -1;
+        ssize_t n;
+        if (pipes) n = splice(in, NULL, out, NULL, FD_COPY_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+        else if (files) n = copy_file_range(in, NULL, out, NULL, FD_COPY_CHUNK, 0);
+        else n = sendfile(out, in, NULL, FD_COPY_CHUNK);
+
+        if (retry(n)) continue;
+        if (n < 0 && !total && unsupported(errno)) {
+            *fallback = true;
+            return 0;
+        }
+        if (n < 0) return -1;
+        if (n == 0) return total;
+        total += n;
+    }
+}
+
+ssize_t fd_copy(int in, int out) {
+    bool fallback;
+    ssize_t total = copy_kernel(in, out, &fallback);
+    if (!fallback) return total;
+    return copy_buffered(in, out, -1);
+}
+
+/* Drains exactly length bytes from the pipe in into out. */
+static ssize_t splice_exact(int in, int out, size_t length) {
+    size_t moved = 0;
+    while (moved < length) {
+        ssize_t n = splice(in, NULL, out, NULL, length - moved, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (retry(n)) continue;
+        if (n < 0 && unsupported(errno)) {
+            n = copy_buffered(in, out, length - moved);
+            if (n < 0) return -1;
+            return moved + n;
+        }
+        if (n <= 0) return -1;
+        moved += n;
+    }
+    return moved;
+}
+
+static ssize_t tee_buffered(int in, const int *outs, int count) {
+    char buffer[FD_COPY_BUFFER];
+    ssize_t total = 0;
+    int status = 0;
+
+    while (1) {
+        if (interrupted()) return -1;
+        ssize_t n = read(in, buffer, sizeof(buffer));
+        if (retry(n)) continue;
+        if (n < 0) return -1;
+        if (n == 0) break;
+        for (int i = 0; i < count; ++i) {
+            if (write_all(outs[i], buffer, n) < 0) status = -1;
+        }
+        total += n;
+    }
+    return status ? -1 : total;
+}
+
+/* Copies in to every descriptor in outs. When in is a pipe, each block is
+ * duplicated with tee(2) into a scratch pipe as large as in, spliced from
+ * there to all outputs but the last, and finally spliced from in itself to
+ * the last output, which consumes it. */
+ssize_t fd_tee(int in, const int *outs, int count) {
+    if (count == 1) return fd_copy(in, outs[0]);
+    if (!is_pipe(in)) return tee_buffered(in, outs, count);
+
+    int scratch[2];
+    if (pipe2(scratch, O_CLOEXEC) == -1) return tee_buffered(in, outs, count);
+    int size = fcntl(in, F_GETPIPE_SZ);
+    if (size > 0) fcntl(scratch[1], F_SETPIPE_SZ, size);
+
+    ssize_t total = 0;
+    int status = 0;
+    while (!interrupted()) {
+        ssize_t n = tee(in, scratch[1], FD_COPY_CHUNK, 0);
+        if (retry(n)) continue;
+        if (n < 0 && !total && unsupported(errno)) {
+            close(scratch[0]);
+            close(scratch[1]);
+            return tee_buffered(in, outs, count);
+        }
+        if (n <= 0) {
+            if (n < 0) status = -1;
+            break;
+        }
+
+        for (int i = 0; i < count - 1; ++i) {
+            if (i > 0) {
+                ssize_t again = tee(in, scratch[1], n, 0);
+                if (again != n) status = -1;
+            }
+            if (splice_exact(scratch[0], outs[i], n) != n) status = -1;
+        }
+        if (splice_exact(in, outs[count - 1], n) != n) {
+            status = -1;
+            break;
+        }
+        total += n;
+    }
+
+    close(scratch[0]);
+    close(scratch[1]);
+    return status || interrupted() ? -1 : total;
+}
+
+/* Bigger pipe buffers mean fewer splice calls per gigabyte. */
+void fd_grow_pipe(int fd) {
+    if (is_pipe(fd)) fcntl(fd, F_SETPIPE_SZ, FD_COPY_CHUNK);
+}
+
+/* Returns a descriptor that reads text from its start. Text that fits in a
+ * pipe is written into one, so no file is involved; larger text goes to an
+ * anonymous memory file instead, as the writer would block on a full pipe
+ * that nobody reads yet. */
+int fd_from_text(const char *text, size_t length) {
+    int pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC)) return -1;
+    if (length <= PIPE_BUF || length <= (size_t)fcntl(pipefd[1], F_GETPIPE_SZ)) {
+        ssize_t written = write_all(pipefd[1], text, length);
+        close(pipefd[1]);
+        if (written >= 0) return pipefd[0];
+        close(pipefd[0]);
+        return -1;
+    }
+    close(pipefd[0]);
+    close(pipefd[1]);
+
+    int fd = memfd_create("here-document", MFD_CLOEXEC);
+    if (fd == -1) return -1;
+    if (write_all(fd, text, length) < 0 || lseek(fd, 0, SEEK_SET) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "functions.h"
+#include "executor.h"
+
+static Function **buckets = NULL;
+static int bucket_count = 0;
+static int function_count = 0;
+
+static unsigned long hash_name(const char *name) {
+    unsigned long hash = 5381;
+    for (const unsigned char *p = (const unsigned char *)name; *p; ++p) {
+        hash = hash * 33 + *p;
+    }
+    return hash;
+}
+
+static void function_table_grow(void) {
+    int new_count = bucket_count ? bucket_count * 2 : FUNCTION_INITIAL_BUCKETS;
+    Function **new_buckets = calloc(new_count, sizeof(Function *));
+
+    for (int i = 0; i < bucket_count; ++i) {
+        Function *function = buckets[i];
+        while (function) {
+            Function *next = function->next;
+            int index = function->hash & (new_count - 1);
+            function->next = new_buckets[index];
+            new_buckets[index] = function;
+            function = next;
+        }
+    }
+
+    free(buckets);
+    buckets = new_buckets;
+    bucket_count = new_count;
+}
+
+static void function_free(Function *function) {
+    arena_free(&function->arena);
+    free(function);
+}
+
+Function *function_find(const char *name) {
+    if (!function_count) return NULL;
+
+    unsigned long hash = hash_name(name);
+    for (Function *function = buckets[hash & (bucket_count - 1)]; function; function = function->next) {
+        if (function->hash == hash && !strcmp(function->name, name)) return function;
+    }
+    return NULL;
+}
+
+/* Unlinks the named function; it is freed now unless a call is still
+ * running it. */
+bool function_unset(const char *name) {
+    if (!function_count) return false;
+
+    unsigned long hash = hash_name(name);
+    Function **link = &buckets[hash & (bucket_count - 1)];
+    while (*link) {
+        Function *function = *link;
+        if (function->hash == hash && !strcmp(function->name, name)) {
+            *link = function->next;
+            function_count--;
+            if (function->active) function->stale = true;
+            else function_free(function);
+            return true;
+        }
+        link = &function->next;
+    }
+    return false;
+}
+
+void function_define(const char *name, ASTNode *body) {
+    function_unset(name);
+    if (function_count + 1 > bucket_count * 3 / 4) function_table_grow();
+
+    Function *function = malloc(sizeof(Function));
+    arena_init_size(&function->arena, FUNCTION_CHUNK_SIZE);
+    function->hash = hash_name(name);
+    function->name = arena_strdup(&function->arena, name);
+    function->body = shell_options.compile ? compile_ast(&function->arena, body) :
+            compile_tree(&function->arena, body);
+    function->active = 0;
+    function->stale = false;
+
+    int index = function->hash & (bucket_count - 1);
+    function->next = buckets[index];
+    buckets[index] = function;
+    function_count++;
+}
+
+void function_retain(Function *function) {
+    function->active++;
+}
+
+void function_release(Function *function) {
+    if (--function->active == 0 && function->stale) function_free(function);
+}
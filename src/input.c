@@ -0,0 +1,189 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "input.h"
+
+#define INPUT_CHUNK 65536
+
+static void input_init(Input *input, int fd) {
+    memset(input, 0, sizeof(*input));
+    input->fd = fd;
+    input->peek[0] = input->peek[1] = -1;
+}
+
+static void input_open_stream(Input *input) {
+    input->capacity = INPUT_CHUNK;
+    input->buffer = malloc(input->capacity);
+}
+
+/* Maps the whole regular file behind fd. Returns false if it is not one or
+ * cannot be mapped, in which case it should be streamed instead. */
+static bool input_map(Input *input, int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) return false;
+
+    if (st.st_size == 0) {
+        input->data = "";
+        return true;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) return false;
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    input->data = data;
+    input->length = st.st_size;
+    input->mapped = true;
+    return true;
+}
+
+bool input_open_file(Input *input, const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return false;
+
+    input_init(input, -1);
+    if (input_map(input, fd)) {
+        close(fd);
+        return true;
+    }
+    input->fd = fd;
+    input_open_stream(input);
+    return true;
+}
+
+void input_open_string(Input *input, const char *text) {
+    input_init(input, -1);
+    input->data = text;
+    input->length = strlen(text);
+}
+
+/* A regular file on fd is mapped, but its offset is shared with the
+ * commands the script runs, so it is kept in step with input->position
+ * (see input_release and input_reclaim). Other streams cannot give back
+ * what was read ahead, so they are read a line at a time; a terminal
+ * already hands out lines. */
+void input_open_fd(Input *input, int fd) {
+    input_init(input, fd);
+    if (input_map(input, fd)) {
+        off_t offset = lseek(fd, 0, SEEK_CUR);
+        input->position = offset > 0 && (size_t)offset < input->length ? (size_t)offset : 0;
+        input->shared_offset = true;
+        return;
+    }
+    input_open_stream(input);
+    if (isatty(fd)) return;
+
+    input->whole_lines = true;
+    struct stat st;
+    if (!fstat(fd, &st) && S_ISFIFO(st.st_mode) && !pipe2(input->peek, O_CLOEXEC)) {
+        fcntl(input->peek[1], F_SETPIPE_SZ, INPUT_CHUNK);
+    }
+}
+
+/* Reads no further than the next newline. A pipe is first copied into the
+ * peek pipe with tee(2), which leaves it unread, to find how much to take;
+ * anything else is read a byte at a time. */
+static ssize_t read_whole_lines(Input *input, char *buffer, size_t size) {
+    if (input->peek[0] >= 0) {
+        int room = fcntl(input->peek[1], F_GETPIPE_SZ);
+        if (room > 0 && size > (size_t)room) size = room;
+        ssize_t n = tee(input->fd, input->peek[1], size, 0);
+        if (n > 0 && read(input->peek[0], buffer, n) == n) {
+            char *newline = memchr(buffer, '\n', n);
+            return read(input->fd, buffer, newline ? (size_t)(newline - buffer + 1) : (size_t)n);
+        }
+        if (!n || (n < 0 && errno == EINTR)) return n;
+        close(input->peek[0]);
+        close(input->peek[1]);
+        input->peek[0] = input->peek[1] = -1;
+    }
+    return read(input->fd, buffer, 1);
+}
+
+static bool read_mapped_line(Input *input, const char **line, size_t *length) {
+    if (input->position >= input->length) return false;
+
+    const char *start = input->data + input->position;
+    size_t remaining = input->length - input->position;
+    const char *newline = memchr(start, '\n', remaining);
+
+    *line = start;
+    *length = newline ? (size_t)(newline - start) : remaining;
+    input->position += newline ? *length + 1 : remaining;
+    return true;
+}
+
+/* Returns the next line without its newline. The line stays valid until the
+ * next call. */
+bool input_read_line(Input *input, const char **line, size_t *length) {
+    if (!input->buffer) return read_mapped_line(input, line, length);
+
+    size_t searched = input->start;
+    while (1) {
+        char *newline = memchr(input->buffer + searched, '\n', input->end - searched);
+        if (newline) {
+            *line = input->buffer + input->start;
+            *length = newline - *line;
+            input->start += *length + 1;
+            return true;
+        }
+        searched = input->end;
+
+        if (input->eof) {
+            if (input->start == input->end) return false;
+            *line = input->buffer + input->start;
+            *length = input->end - input->start;
+            input->start = input->end;
+            return true;
+        }
+
+        if (input->start > 0) {
+            memmove(input->buffer, input->buffer + input->start, input->end - input->start);
+            input->end -= input->start;
+            searched -= input->start;
+            input->start = 0;
+        }
+        if (input->end == input->capacity) {
+            input->capacity *= 2;
+            input->buffer = realloc(input->buffer, input->capacity);
+        }
+
+        size_t room = input->capacity - input->end;
+        ssize_t n = input->whole_lines ? read_whole_lines(input, input->buffer + input->end, room) :
+                read(input->fd, input->buffer + input->end, room);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) perror("read failed");
+        if (n <= 0) input->eof = true;
+        else input->end += n;
+    }
+}
+
+/* Moves the shared file offset to the first unread byte before a command
+ * runs, so commands reading the shell's stdin see what follows. */
+void input_release(Input *input) {
+    if (input->shared_offset) lseek(input->fd, input->position, SEEK_SET);
+}
+
+/* Picks up whatever the command consumed from the shared offset. */
+void input_reclaim(Input *input) {
+    if (!input->shared_offset) return;
+    off_t offset = lseek(input->fd, 0, SEEK_CUR);
+    if (offset >= 0) input->position = (size_t)offset < input->length ? (size_t)offset : input->length;
+}
+
+void input_close(Input *input) {
+    if (input->mapped) munmap((void *)input->data, input->length);
+    free(input->buffer);
+    if (input->peek[0] >= 0) {
+        close(input->peek[0]);
+        close(input->peek[1]);
+    }
+    if (input->fd > STDERR_FILENO) close(input->fd);
+    input_init(input, -1);
+}
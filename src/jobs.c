@@ -0,0 +1,750 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "jobs.h"
+#include "builtins.h"
+#include "executor.h"
+#include "timing.h"
+#include "output.h"
+
+#define JOBS_MAX_REMEMBERED 1024
+
+static Job **jobs = NULL;
+static int job_slots = 0;
+static int current_job = 0;
+static int previous_job = 0;
+static pid_t last_background_pid = 0;
+static unsigned long next_sequence = 0;
+
+/* Background jobs started while others were still running form a batch;
+ * when a batch that had to queue finishes, its throughput is reported. */
+static struct {
+    int started;
+    bool throttled;
+    struct timespec start;
+    struct timespec end;
+    struct rusage usage;
+} batch;
+
+static const struct {
+    const char *name;
+    int number;
+} signal_names[] = {
+    { "HUP", SIGHUP }, { "INT", SIGINT }, { "QUIT", SIGQUIT }, { "ILL", SIGILL },
+    { "ABRT", SIGABRT }, { "FPE", SIGFPE }, { "KILL", SIGKILL }, { "SEGV", SIGSEGV },
+    { "PIPE", SIGPIPE }, { "ALRM", SIGALRM }, { "TERM", SIGTERM }, { "USR1", SIGUSR1 },
+    { "USR2", SIGUSR2 }, { "CHLD", SIGCHLD }, { "CONT", SIGCONT }, { "STOP", SIGSTOP },
+    { "TSTP", SIGTSTP }, { "TTIN", SIGTTIN }, { "TTOU", SIGTTOU },
+};
+
+#define SIGNAL_NAME_COUNT (int)(sizeof(signal_names) / sizeof(signal_names[0]))
+
+static void add_usage(struct rusage *total, const struct rusage *usage) {
+    total->ru_utime.tv_sec += usage->ru_utime.tv_sec;
+    total->ru_utime.tv_usec += usage->ru_utime.tv_usec;
+    if (total->ru_utime.tv_usec >= 1000000) {
+        total->ru_utime.tv_sec++;
+        total->ru_utime.tv_usec -= 1000000;
+    }
+    total->ru_stime.tv_sec += usage->ru_stime.tv_sec;
+    total->ru_stime.tv_usec += usage->ru_stime.tv_usec;
+    if (total->ru_stime.tv_usec >= 1000000) {
+        total->ru_stime.tv_sec++;
+        total->ru_stime.tv_usec -= 1000000;
+    }
+    if (usage->ru_maxrss > total->ru_maxrss) total->ru_maxrss = usage->ru_maxrss;
+    total->ru_nvcsw += usage->ru_nvcsw;
+    total->ru_nivcsw += usage->ru_nivcsw;
+}
+
+/* Collects every pending state change of the job's processes. Only uses
+ * async-signal-safe calls: it runs from the SIGCHLD handler. */
+static void job_poll(Job *job) {
+    bool running = false;
+    bool stopped = false;
+
+    for (int i = 0; i < job->proc_count; ++i) {
+        JobProcess *proc = &job->procs[i];
+        if (!proc->done) {
+            int status;
+            struct rusage usage;
+            pid_t pid;
+            do {
+                pid = wait4(proc->pid, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage);
+            } while (pid < 0 && errno == EINTR);
+
+            if (pid < 0) {
+                proc->done = true;
+                proc->status = 0;
+            }
+            else if (pid > 0 && WIFSTOPPED(status)) proc->stopped = true;
+            else if (pid > 0 && WIFCONTINUED(status)) proc->stopped = false;
+            else if (pid > 0) {
+                proc->done = true;
+                proc->status = status;
+                add_usage(&job->usage, &usage);
+            }
+        }
+        if (!proc->done) {
+            if (proc->stopped) stopped = true;
+            else running = true;
+        }
+    }
+
+    if (running) job->state = JOB_RUNNING;
+    else if (stopped) job->state = JOB_STOPPED;
+    else if (job->state != JOB_DONE) {
+        clock_gettime(CLOCK_MONOTONIC, &job->end);
+        job->state = JOB_DONE;
+        if (job->batched) {
+            add_usage(&batch.usage, &job->usage);
+            batch.end = job->end;
+        }
+    }
+}
+
+static void sigchld_handler(int sig) {
+    (void)sig;
+    int saved_errno = errno;
+    for (int i = 0; i < job_slots; ++i) {
+        if (jobs[i] && jobs[i]->state != JOB_DONE && jobs[i]->state != JOB_QUEUED) job_poll(jobs[i]);
+    }
+    errno = saved_errno;
+}
+
+void jobs_init(void) {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = sigchld_handler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGCHLD, &action, NULL);
+}
+
+void jobs_block(sigset_t *saved) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, saved);
+}
+
+void jobs_unblock(const sigset_t *saved) {
+    sigprocmask(SIG_SETMASK, saved, NULL);
+}
+
+void jobs_reap(void) {
+    sigset_t saved;
+    jobs_block(&saved);
+    sigchld_handler(SIGCHLD);
+    jobs_unblock(&saved);
+}
+
+static void job_record(Job *job);
+
+static void job_free(Job *job) {
+    job_record(job);
+    if (current_job == job->id) {
+        current_job = previous_job;
+        previous_job = 0;
+    }
+    if (previous_job == job->id) previous_job = 0;
+
+    jobs[job->id - 1] = NULL;
+    if (job->node) arena_free(&job->arena);
+    free(job->cwd);
+    free(job->procs);
+    free(job->command);
+    free(job);
+}
+
+/* Removes jobs from the table and clears the handler's view of them. Used
+ * by forked children, whose parent's jobs are not their own children. The
+ * jobs are not freed: the child may be about to run one of their trees. */
+void jobs_clear(void) {
+    for (int i = 0; i < job_slots; ++i) jobs[i] = NULL;
+    current_job = previous_job = 0;
+}
+
+static Job *job_create(int count, JobState state) {
+    int slot = 0;
+    while (slot < job_slots && jobs[slot]) slot++;
+    if (slot == job_slots) {
+        int new_slots = job_slots ? job_slots * 2 : 16;
+        Job **grown = realloc(jobs, new_slots * sizeof(Job *));
+        memset(grown + job_slots, 0, (new_slots - job_slots) * sizeof(Job *));
+        jobs = grown;
+        job_slots = new_slots;
+    }
+
+    Job *job = calloc(1, sizeof(Job));
+    job->id = slot + 1;
+    job->state = state;
+    job->procs = calloc(count, sizeof(JobProcess));
+    job->proc_count = count;
+    job->sequence = next_sequence++;
+    clock_gettime(CLOCK_MONOTONIC, &job->start);
+    jobs[slot] = job;
+
+    if (current_job != job->id) previous_job = current_job;
+    current_job = job->id;
+    return job;
+}
+
+Job *jobs_add(pid_t pgid, const pid_t *pids, int count, ASTNode *node, JobState state) {
+    sigset_t saved;
+    jobs_block(&saved);
+
+    Job *job = job_create(count, state);
+    job->pgid = pgid;
+    for (int i = 0; i < count; ++i) {
+        job->procs[i].pid = pids[i];
+        job->procs[i].stopped = (state == JOB_STOPPED && i == 0);
+        job->procs[i].done = pids[i] <= 0;
+        job->procs[i].status = 127 << 8;
+    }
+    job->command = ast_to_string(node);
+    if (state == JOB_RUNNING) last_background_pid = pids[count - 1];
+
+    /* A child may have changed state before it was registered. */
+    job_poll(job);
+    jobs_unblock(&saved);
+    return job;
+}
+
+int jobs_limit(void) {
+    static int online = 0;
+    if (shell_options.max_jobs > 0) return shell_options.max_jobs;
+    if (!online) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        online = cpus > 0 ? (int)cpus : 1;
+    }
+    return online;
+}
+
+static int count_jobs(sig_atomic_t state) {
+    int count = 0;
+    for (int i = 0; i < job_slots; ++i) {
+        if (jobs[i] && jobs[i]->state == state) count++;
+    }
+    return count;
+}
+
+/* The directory a queued job has to start in, or NULL while the shell is
+ * still in it. */
+static const char *job_directory(Job *job) {
+    char cwd[4096];
+    if (!job->cwd || (getcwd(cwd, sizeof(cwd)) && !strcmp(cwd, job->cwd))) return NULL;
+    return job->cwd;
+}
+
+/* Launches a job created by jobs_submit: node, or the copy a queued job
+ * kept. Must be called with SIGCHLD blocked. A job that cannot be started
+ * finishes with status 127, and false is returned. */
+static bool job_start(Job *job, ASTNode *node) {
+    pid_t pid;
+    if (job->node) {
+        pid = launch_background(job->node, job_directory(job), job->has_vars ? &job->vars : NULL);
+        arena_free(&job->arena);
+        job->node = NULL;
+        job->has_vars = false;
+    }
+    else pid = launch_background(node, NULL, NULL);
+
+    if (pid < 0) {
+        job->procs[0].done = true;
+        job->procs[0].status = 127 << 8;
+        clock_gettime(CLOCK_MONOTONIC, &job->end);
+        job->state = JOB_DONE;
+        return false;
+    }
+
+    if (!batch.started) {
+        memset(&batch, 0, sizeof(batch));
+        clock_gettime(CLOCK_MONOTONIC, &batch.start);
+    }
+    batch.started++;
+    job->batched = true;
+
+    job->pgid = pid;
+    job->procs[0].pid = pid;
+    job->procs[0].status = 127 << 8;
+    job->state = JOB_RUNNING;
+    clock_gettime(CLOCK_MONOTONIC, &job->start);
+    last_background_pid = pid;
+    job_poll(job);
+    return true;
+}
+
+static Job *oldest_queued(void) {
+    Job *oldest = NULL;
+    for (int i = 0; i < job_slots; ++i) {
+        Job *job = jobs[i];
+        if (job && job->state == JOB_QUEUED && (!oldest || job->sequence < oldest->sequence)) oldest = job;
+    }
+    return oldest;
+}
+
+static double timespec_seconds(struct timespec ts) {
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double timeval_seconds(struct timeval tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void report_batch(void) {
+    double wall = timespec_seconds(batch.end) - timespec_seconds(batch.start);
+    double user = timeval_seconds(batch.usage.ru_utime);
+    double sys = timeval_seconds(batch.usage.ru_stime);
+    if (wall <= 0) wall = 1e-9;
+
+    output_printf(STDERR_FILENO,
+            "parallel: %d jobs in %.3fs, %.2f jobs/s, user %.3fs sys %.3fs, %.2f of %d CPUs busy\n", batch.started,
+            wall, batch.started / wall, user, sys, (user + sys) / wall, jobs_limit());
+}
+
+/* Starts queued jobs while fewer than jobs_limit() are running, and reports
+ * the batch once nothing is left running or queued. SIGCHLD must be
+ * blocked. */
+static void schedule(void) {
+    Job *job;
+    while (count_jobs(JOB_RUNNING) < jobs_limit() && (job = oldest_queued())) job_start(job, NULL);
+
+    if (!batch.started) return;
+    for (int i = 0; i < job_slots; ++i) {
+        if (jobs[i] && jobs[i]->batched && jobs[i]->state != JOB_DONE) return;
+        if (jobs[i] && jobs[i]->state == JOB_QUEUED) return;
+    }
+    if (batch.throttled) report_batch();
+    batch.started = 0;
+}
+
+/* Keeps what a queued job needs to start later as it would have now.
+ * Returns false if its words could not be expanded. */
+static bool job_queue(Job *job, ASTNode *node) {
+    bool fixed;
+    arena_init(&job->arena);
+    job->node = background_copy(&job->arena, node, &fixed);
+    if (!job->node) {
+        arena_free(&job->arena);
+        return false;
+    }
+    job->cwd = getcwd(NULL, 0);
+    if (!fixed) {
+        var_snapshot(&job->arena, &job->vars);
+        job->has_vars = true;
+    }
+    return true;
+}
+
+/* Starts node as a background job, or queues a copy of it when jobs_limit()
+ * jobs are already running. Called with SIGCHLD blocked. Returns NULL if
+ * the command could not be started. */
+Job *jobs_submit(ASTNode *node) {
+    schedule();
+
+    Job *job = job_create(1, JOB_QUEUED);
+    job->command = ast_to_string(node);
+
+    if (count_jobs(JOB_RUNNING) < jobs_limit() && oldest_queued() == job) {
+        if (!job_start(job, node)) {
+            job_free(job);
+            return NULL;
+        }
+    }
+    else if (job_queue(job, node)) batch.throttled = true;
+    else {
+        job->procs[0].done = true;
+        job->procs[0].status = 1 << 8;
+        clock_gettime(CLOCK_MONOTONIC, &job->end);
+        job->state = JOB_DONE;
+    }
+    return job;
+}
+
+void jobs_schedule(void) {
+    sigset_t saved;
+    jobs_block(&saved);
+    schedule();
+    jobs_unblock(&saved);
+}
+
+/* Lets every queued job start before the shell exits; jobs that are
+ * already running are left alone. */
+void jobs_drain(void) {
+    sigset_t saved;
+    jobs_block(&saved);
+    for (;;) {
+        schedule();
+        if (!oldest_queued()) break;
+        sigsuspend(&saved);
+    }
+    jobs_unblock(&saved);
+}
+
+/* Finds the status of a process the SIGCHLD handler already reaped. */
+bool jobs_reaped_status(pid_t pid, int *status) {
+    sigset_t saved;
+    jobs_block(&saved);
+    bool found = false;
+    for (int i = 0; i < job_slots && !found; ++i) {
+        for (int p = 0; jobs[i] && p < jobs[i]->proc_count && !found; ++p) {
+            JobProcess *proc = &jobs[i]->procs[p];
+            if (proc->pid == pid && proc->done) {
+                *status = proc->status;
+                found = true;
+            }
+        }
+    }
+    jobs_unblock(&saved);
+    return found;
+}
+
+Job *jobs_find(int id) {
+    if (id < 1 || id > job_slots) return NULL;
+    return jobs[id - 1];
+}
+
+pid_t jobs_last_pid(void) {
+    return last_background_pid;
+}
+
+static int job_status(Job *job) {
+    int result = 0;
+    for (int i = 0; i < job->proc_count; ++i) {
+        int status = wait_status(job->procs[i].status);
+        if (i == job->proc_count - 1 && !(shell_options.pipefail && result)) result = status;
+        else if (shell_options.pipefail && status) result = status;
+    }
+    return result;
+}
+
+/* With set -o timing a finished job is recorded once, when the shell first
+ * notices it or forgets it. */
+static void job_record(Job *job) {
+    if (!shell_options.timing || job->timed || job->state != JOB_DONE) return;
+
+    TimingSample sample;
+    timing_sample(&sample, &job->start, &job->end, &job->usage);
+    timing_record("job", job->id, job->command, job_status(job), &sample);
+    job->timed = true;
+}
+
+static char job_marker(Job *job) {
+    if (job->id == current_job) return '+';
+    if (job->id == previous_job) return '-';
+    return ' ';
+}
+
+static const char *signal_name(int number) {
+    for (int i = 0; i < SIGNAL_NAME_COUNT; ++i) {
+        if (signal_names[i].number == number) return signal_names[i].name;
+    }
+    return "UNKNOWN";
+}
+
+static void format_state(Job *job, char *buffer, size_t size) {
+    if (job->state == JOB_QUEUED) snprintf(buffer, size, "Queued");
+    else if (job->state == JOB_RUNNING) snprintf(buffer, size, "Running");
+    else if (job->state == JOB_STOPPED) snprintf(buffer, size, "Stopped");
+    else {
+        int raw = job->procs[job->proc_count - 1].status;
+        int status = job_status(job);
+        if (WIFSIGNALED(raw)) snprintf(buffer, size, "Killed (SIG%s)", signal_name(WTERMSIG(raw)));
+        else if (status) snprintf(buffer, size, "Exit %d", status);
+        else snprintf(buffer, size, "Done");
+    }
+}
+
+static void print_job(Job *job, bool verbose) {
+    char state[32];
+    format_state(job, state, sizeof(state));
+
+    if (!verbose) {
+        output_printf(STDOUT_FILENO, "[%d]%c  %-24s%s%s\n", job->id, job_marker(job), state, job->command,
+                job->state == JOB_RUNNING || job->state == JOB_QUEUED ? " &" : "");
+        return;
+    }
+
+    struct timespec end = job->end;
+    if (job->state != JOB_DONE) clock_gettime(CLOCK_MONOTONIC, &end);
+    double wall = timespec_seconds(end) - timespec_seconds(job->start);
+    if (job->state == JOB_QUEUED) end = job->start;
+    double user = timeval_seconds(job->usage.ru_utime);
+    double sys = timeval_seconds(job->usage.ru_stime);
+
+    output_printf(STDOUT_FILENO, "[%d]%c %d %-16s wall %.3fs user %.3fs sys %.3fs  %s\n", job->id, job_marker(job),
+            job->procs[0].pid, state, wall, user, sys, job->command);
+}
+
+/* Reports jobs that finished or stopped since the last call. Interactive
+ * shells print and forget finished jobs; otherwise they are kept for 'wait'
+ * up to JOBS_MAX_REMEMBERED. */
+void jobs_notify(bool print) {
+    sigset_t saved;
+    jobs_block(&saved);
+    schedule();
+
+    int done = 0;
+    for (int i = 0; i < job_slots; ++i) {
+        Job *job = jobs[i];
+        if (!job) continue;
+        if (job->state == JOB_DONE) {
+            job_record(job);
+            if (print) {
+                print_job(job, false);
+                job_free(job);
+            }
+            else done++;
+        }
+        else if (job->state == JOB_STOPPED && !job->notified) {
+            if (print) print_job(job, false);
+            job->notified = true;
+        }
+    }
+
+    for (int i = 0; i < job_slots && done > JOBS_MAX_REMEMBERED; ++i) {
+        if (jobs[i] && jobs[i]->state == JOB_DONE) {
+            job_free(jobs[i]);
+            done--;
+        }
+    }
+
+    output_flush_all();
+    jobs_unblock(&saved);
+}
+
+static Job *parse_jobspec(const char *spec, const char *builtin) {
+    Job *job = NULL;
+
+    if (!spec || !strcmp("%%", spec) || !strcmp("%+", spec) || !strcmp("%", spec)) {
+        job = jobs_find(current_job);
+    }
+    else if (!strcmp("%-", spec)) job = jobs_find(previous_job);
+    else if (spec[0] == '%' && isdigit((unsigned char)spec[1])) job = jobs_find(atoi(spec + 1));
+    else if (spec[0] == '%') {
+        size_t length = strlen(spec + 1);
+        for (int i = job_slots - 1; i >= 0 && !job; --i) {
+            if (jobs[i] && !strncmp(jobs[i]->command, spec + 1, length)) job = jobs[i];
+        }
+    }
+    else {
+        pid_t pid = atoi(spec);
+        for (int i = 0; i < job_slots && !job; ++i) {
+            for (int p = 0; jobs[i] && p < jobs[i]->proc_count; ++p) {
+                if (jobs[i]->procs[p].pid == pid) job = jobs[i];
+            }
+        }
+    }
+
+    if (!job) output_printf(STDERR_FILENO, "%s: %s: no such job\n", builtin, spec ? spec : "current");
+    return job;
+}
+
+static bool job_pending(Job *job) {
+    return job->state == JOB_RUNNING || job->state == JOB_QUEUED;
+}
+
+/* Queued jobs keep being started while waiting, so a wait on a queued job
+ * cannot block forever. */
+static void wait_while_running(Job *job, const sigset_t *saved) {
+    for (;;) {
+        schedule();
+        if (!job_pending(job)) break;
+        sigsuspend(saved);
+    }
+}
+
+int builtin_jobs(char **args) {
+    bool verbose = args[1] && !strcmp("-l", args[1]);
+
+    sigset_t saved;
+    jobs_block(&saved);
+    for (int i = 0; i < job_slots; ++i) {
+        Job *job = jobs[i];
+        if (!job) continue;
+        print_job(job, verbose);
+        if (job->state == JOB_DONE) job_free(job);
+        else if (job->state == JOB_STOPPED) job->notified = true;
+    }
+    output_flush_all();
+    jobs_unblock(&saved);
+    return 0;
+}
+
+int builtin_wait(char **args) {
+    sigset_t saved;
+    jobs_block(&saved);
+
+    int status = 0;
+    if (!args[1]) {
+        for (int i = 0; i < job_slots; ++i) {
+            if (!jobs[i]) continue;
+            wait_while_running(jobs[i], &saved);
+            if (jobs[i]->state == JOB_DONE) job_free(jobs[i]);
+            /* Queued jobs may have started in slots already passed. */
+            if (count_jobs(JOB_RUNNING) || count_jobs(JOB_QUEUED)) i = -1;
+        }
+    }
+
+    for (int i = 1; args[i]; ++i) {
+        Job *job = parse_jobspec(args[i], "wait");
+        if (!job) {
+            status = 127;
+            continue;
+        }
+        wait_while_running(job, &saved);
+        status = job->state == JOB_DONE ? job_status(job) : 128 + SIGTSTP;
+        if (job->state == JOB_DONE) job_free(job);
+    }
+
+    jobs_unblock(&saved);
+    return status;
+}
+
+int builtin_fg(char **args) {
+    sigset_t saved;
+    jobs_block(&saved);
+
+    Job *job = parse_jobspec(args[1], "fg");
+    if (!job) {
+        jobs_unblock(&saved);
+        return 1;
+    }
+
+    output_printf(STDOUT_FILENO, "%s\n", job->command);
+    output_flush_all();
+
+    if (job->state == JOB_QUEUED && !job_start(job, NULL)) {
+        job_free(job);
+        jobs_unblock(&saved);
+        return 127;
+    }
+    give_terminal(job->pgid);
+    for (int i = 0; i < job->proc_count; ++i) job->procs[i].stopped = false;
+    if (job->state == JOB_STOPPED) job->state = JOB_RUNNING;
+    job->notified = false;
+    kill(-job->pgid, SIGCONT);
+
+    wait_while_running(job, &saved);
+    give_terminal(getpgrp());
+
+    int status;
+    if (job->state == JOB_DONE) {
+        status = job_status(job);
+        job_free(job);
+    }
+    else {
+        status = 128 + SIGTSTP;
+        current_job = job->id;
+        print_job(job, false);
+        job->notified = true;
+    }
+
+    jobs_unblock(&saved);
+    return status;
+}
+
+static int background_job(const char *spec) {
+    Job *job = parse_jobspec(spec, "bg");
+    if (!job) return 1;
+
+    if (job->state == JOB_STOPPED) {
+        for (int i = 0; i < job->proc_count; ++i) job->procs[i].stopped = false;
+        job->state = JOB_RUNNING;
+        job->notified = false;
+        kill(-job->pgid, SIGCONT);
+    }
+    output_printf(STDOUT_FILENO, "[%d]%c %s &\n", job->id, job_marker(job), job->command);
+    return 0;
+}
+
+int builtin_bg(char **args) {
+    sigset_t saved;
+    jobs_block(&saved);
+
+    int status = 0;
+    if (!args[1]) status = background_job(NULL);
+    for (int i = 1; args[i]; ++i) {
+        if (background_job(args[i])) status = 1;
+    }
+
+    output_flush_all();
+    jobs_unblock(&saved);
+    return status;
+}
+
+static int parse_signal(const char *name) {
+    if (isdigit((unsigned char)*name)) return atoi(name);
+    if (!strncmp("SIG", name, 3)) name += 3;
+    for (int i = 0; i < SIGNAL_NAME_COUNT; ++i) {
+        if (!strcmp(signal_names[i].name, name)) return signal_names[i].number;
+    }
+    return -1;
+}
+
+int builtin_kill(char **args) {
+    int signal_number = SIGTERM;
+    int i = 1;
+
+    if (args[i] && !strcmp("-l", args[i])) {
+        for (int s = 0; s < SIGNAL_NAME_COUNT; ++s) {
+            output_printf(STDOUT_FILENO, "%2d) SIG%s\n", signal_names[s].number, signal_names[s].name);
+        }
+        return 0;
+    }
+    if (args[i] && !strcmp("-s", args[i]) && args[i + 1]) {
+        signal_number = parse_signal(args[i + 1]);
+        i += 2;
+    }
+    else if (args[i] && args[i][0] == '-' && args[i][1]) {
+        signal_number = parse_signal(args[i] + 1);
+        i++;
+    }
+    if (signal_number < 0) {
+        output_printf(STDERR_FILENO, "kill: %s: invalid signal specification\n", args[i - 1]);
+        return 1;
+    }
+    if (!args[i]) {
+        output_printf(STDERR_FILENO, "kill: usage: kill [-s sigspec | -signum] pid | jobspec ...\n");
+        return 2;
+    }
+
+    int status = 0;
+    for (; args[i]; ++i) {
+        Job *job = NULL;
+        pid_t target;
+        if (args[i][0] == '%') {
+            job = parse_jobspec(args[i], "kill");
+            if (!job) {
+                status = 1;
+                continue;
+            }
+            /* Signalling a job that has not started yet cancels it. */
+            if (job->state == JOB_QUEUED) {
+                if (!signal_number) continue;
+                job->procs[0].done = true;
+                job->procs[0].status = signal_number;
+                clock_gettime(CLOCK_MONOTONIC, &job->end);
+                job->state = JOB_DONE;
+                continue;
+            }
+            target = -job->pgid;
+        }
+        else target = atoi(args[i]);
+
+        if (kill(target, signal_number)) {
+            output_printf(STDERR_FILENO, "kill: (%s) - %s\n", args[i], strerror(errno));
+            status = 1;
+        }
+        /* A stopped job only acts on the signal once it runs again. */
+        else if (job && job->state == JOB_STOPPED && signal_number != SIGSTOP && signal_number != SIGTSTP) {
+            kill(target, SIGCONT);
+        }
+    }
+    return status;
+}
@@ -3,178 +3,295 @@
 #include <string.h>
 #include <ctype.h>
 #include "lexer.h"
+#include "scan.h"
 
-Lexer *lexer_init(const char *input) {
-    Lexer *lexer = malloc(sizeof(Lexer));
+void lexer_init(Lexer *lexer, const char *input) {
     lexer->input = input;
     lexer->position = 0;
     lexer->length = strlen(input);
-    return lexer;
+    lexer->depth = 0;
+    lexer->paren_position = 0;
+    lexer->error.type = LEX_OK;
+    lexer->error.position = 0;
 }
 
-void free_lexer(Lexer *lexer) {
-    free(lexer);
+static Token lexer_error(Lexer *lexer, LexErrorType type, int position) {
+    Token token;
+    lexer->error.type = type;
+    lexer->error.position = position;
+    token.type = TOKEN_ERROR;
+    token.offset = position;
+    token.length = 0;
+    return token;
 }
 
 void skip_whitespace(Lexer *lexer) {
-    while (lexer->position < lexer->length && 
-            isspace(lexer->input[lexer->position])) {
-        lexer->position++;
+    lexer->position = scan_skip_space(lexer->input, lexer->position, lexer->length);
+}
+
+int lexer_backquote_end(const char *input, int position, int length) {
+    for (position++; position < length; ++position) {
+        if (input[position] == '\\') position++;
+        else if (input[position] == '`') return position + 1;
     }
+    return -1;
 }
 
-char *lexer_read_word(Lexer *lexer) {
-    int start = lexer->position;
-    while (lexer->position < lexer->length && 
-            !isspace(lexer->input[lexer->position]) && 
-            !strchr("|&;<>()", lexer->input[lexer->position])) {
-        lexer->position++;
+/* Double quotes may contain substitutions, which may contain quotes. */
+static int double_quote_end(const char *input, int position, int length) {
+    position++;
+    while (position >= 0 && position < length) {
+        char c = input[position];
+        if (c == '"') return position + 1;
+        if (c == '\\') position += 2;
+        else if (c == '$' && position + 1 < length && input[position + 1] == '(') {
+            position = lexer_substitution_end(input, position, length);
+        }
+        else if (c == '$' && position + 1 < length && input[position + 1] == '{') {
+            position = lexer_brace_end(input, position, length);
+        }
+        else if (c == '`') position = lexer_backquote_end(input, position, length);
+        else position++;
+    }
+    return -1;
+}
+
+/* Returns the position just past the '}' that closes the '${' at position,
+ * or -1. The word inside may hold quotes and further expansions. */
+int lexer_brace_end(const char *input, int position, int length) {
+    position += 2;
+    while (position >= 0 && position < length) {
+        char c = input[position];
+        if (c == '}') return position + 1;
+        if (c == '\\') position += 2;
+        else if (c == '\'') {
+            const char *end = memchr(input + position + 1, '\'', length - position - 1);
+            position = end ? end - input + 1 : -1;
+        }
+        else if (c == '"') position = double_quote_end(input, position, length);
+        else if (c == '`') position = lexer_backquote_end(input, position, length);
+        else if (c == '$' && position + 1 < length && input[position + 1] == '(') {
+            position = lexer_substitution_end(input, position, length);
+        }
+        else if (c == '$' && position + 1 < length && input[position + 1] == '{') {
+            position = lexer_brace_end(input, position, length);
+        }
+        else position++;
     }
+    return -1;
+}
 
-    int length = lexer->position - start;
-    char *value = malloc(length + 1);
-    strncpy(value, lexer->input + start, length);
-    value[length] = '\0';
-    return value;
+/* Returns the position just past the ')' that closes the '$(' at position,
+ * or -1 if the input ends first. */
+int lexer_substitution_end(const char *input, int position, int length) {
+    int depth = 1;
+    position += 2;
+    while (position >= 0 && position < length) {
+        switch (input[position]) {
+            case '\\':
+                position += 2;
+                break;
+            case '\'': {
+                const char *end = memchr(input + position + 1, '\'', length - position - 1);
+                position = end ? end - input + 1 : -1;
+                break;
+            }
+            case '"':
+                position = double_quote_end(input, position, length);
+                break;
+            case '`':
+                position = lexer_backquote_end(input, position, length);
+                break;
+            case '(':
+                depth++;
+                position++;
+                break;
+            case ')':
+                position++;
+                if (--depth == 0) return position;
+                break;
+            default:
+                position++;
+                break;
+        }
+    }
+    return -1;
 }
 
-char *lexer_read_quotation(Lexer *lexer, char quote) {
-    lexer->position++;
+bool lexer_read_quotation(Lexer *lexer, char quote) {
+    int end;
+    if (quote == '"') end = double_quote_end(lexer->input, lexer->position, lexer->length);
+    else {
+        const char *close = memchr(lexer->input + lexer->position + 1, quote, lexer->length - lexer->position - 1);
+        end = close ? close - lexer->input + 1 : -1;
+    }
+    if (end < 0) return false;
+    lexer->position = end;
+    return true;
+}
+
+void lexer_read_word(Lexer *lexer, Token *token) {
     int start = lexer->position;
-    while (lexer->position < lexer->length && lexer->input[lexer->position] != quote) {
+    while ((lexer->position = scan_word_end(lexer->input, lexer->position, lexer->length)) < lexer->length) {
+        char c = lexer->input[lexer->position];
+        char next = lexer->position + 1 < lexer->length ? lexer->input[lexer->position + 1] : '\0';
+        bool process = (c == '<' || c == '>') && next == '(';
+        if (!process && (scan_class[(unsigned char)c] & (SCAN_SPACE | SCAN_OPERATOR))) break;
+
+        if (c == '"' || c == '\'') {
+            int quote_position = lexer->position;
+            if (!lexer_read_quotation(lexer, c)) {
+                *token = lexer_error(lexer, LEX_UNCLOSED_QUOTE, quote_position);
+                return;
+            }
+            continue;
+        }
+        /* <(LIST) and >(LIST) close like $(LIST). */
+        if (c == '`' || process || (c == '$' && (next == '(' || next == '{'))) {
+            int end = c == '`' ? lexer_backquote_end(lexer->input, lexer->position, lexer->length) :
+                    next == '(' ? lexer_substitution_end(lexer->input, lexer->position, lexer->length) :
+                    lexer_brace_end(lexer->input, lexer->position, lexer->length);
+            if (end < 0) {
+                *token = lexer_error(lexer, LEX_UNCLOSED_SUBSTITUTION, lexer->position);
+                return;
+            }
+            lexer->position = end;
+            continue;
+        }
+        if (c == '\\' && lexer->position + 1 < lexer->length) lexer->position++;
         lexer->position++;
     }
-    int length = lexer->position - start;
-    lexer->position++;
 
-    char *value = malloc(length + 1);
-    strncpy(value, lexer->input + start, length);
-    value[length] = '\0';
-    return value;
+    token->type = TOKEN_COMMAND;
+    token->offset = start;
+    token->length = lexer->position - start;
 }
 
-Token *lexer_next_token(Lexer *lexer) {
+static Token lexer_operator(Lexer *lexer, TokenType type, int width) {
+    Token token;
+    token.type = type;
+    token.offset = lexer->position;
+    token.length = width;
+    lexer->position += width;
+    return token;
+}
+
+Token lexer_next_token(Lexer *lexer) {
+    Token token;
     skip_whitespace(lexer);
 
+    /* A comment runs to the end of the line; the newline is still a token. */
+    if (lexer->position < lexer->length && lexer->input[lexer->position] == '#') {
+        const char *end = memchr(lexer->input + lexer->position, '\n', lexer->length - lexer->position);
+        lexer->position = end ? end - lexer->input : lexer->length;
+    }
+
     if (lexer->position >= lexer->length) {
-        Token *token = malloc(sizeof(Token));
-        token->type = TOKEN_EOF;
-        token->value = NULL;
+        if (lexer->depth > 0) {
+            return lexer_error(lexer, LEX_UNBALANCED_PAREN, lexer->paren_position);
+        }
+        token.type = TOKEN_EOF;
+        token.offset = lexer->position;
+        token.length = 0;
         return token;
     }
 
     char current = lexer->input[lexer->position];
 
-    if (current == '"' || current == '\'') {
-        char *value = lexer_read_quotation(lexer, current);
-
-        Token *token = malloc(sizeof(Token));
-        token->type = TOKEN_COMMAND;
-        token->value = value;
-        return token;
-    }
-
     if (lexer->position + 1 < lexer->length) {
         char next = lexer->input[lexer->position + 1];
 
-        if (current == '&' && next == '&') {
-            Token *token = malloc(sizeof(Token));
-            token->type = TOKEN_AND;
-            token->value = NULL;
-            lexer->position += 2;
-            return token;
+        if (current == '&' && next == '&') return lexer_operator(lexer, TOKEN_AND, 2);
+        if (current == '|' && next == '|') return lexer_operator(lexer, TOKEN_OR, 2);
+        if (current == '>' && next == '>') return lexer_operator(lexer, TOKEN_APPEND_REDIR, 2);
+        if (current == '<' && next == '<') {
+            char third = lexer->position + 2 < lexer->length ? lexer->input[lexer->position + 2] : '\0';
+            if (third == '<') return lexer_operator(lexer, TOKEN_HERESTRING, 3);
+            return lexer_operator(lexer, TOKEN_HEREDOC, third == '-' ? 3 : 2);
         }
-        if (current == '|' && next == '|') {
-            Token *token = malloc(sizeof(Token));
-            token->type = TOKEN_OR;
-            token->value = NULL;
-            lexer->position += 2;
-            return token;
-        }
-        if (current == '>' && next == '>') {
-            Token *token = malloc(sizeof(Token));
-            token->type = TOKEN_APPEND_REDIR;
-            token->value = NULL;
-            lexer->position += 2;
+        if ((current == '<' || current == '>') && next == '(') {
+            lexer_read_word(lexer, &token);
             return token;
         }
     }
 
     switch (current) {
-        case '|':
-            Token *pipe_token = malloc(sizeof(Token));
-            pipe_token->type = TOKEN_PIPE;
-            pipe_token->value = NULL;
-            lexer->position++;
-            return pipe_token;
-        case '&':
-            Token *bg_token = malloc(sizeof(Token));
-            bg_token->type = TOKEN_BACKGROUND;
-            bg_token->value = NULL;
-            lexer->position++;
-            return bg_token;
-        case ';':
-            Token *semi_token = malloc(sizeof(Token));
-            semi_token->type = TOKEN_SEMICOLON;
-            semi_token->value = NULL;
-            lexer->position++;
-            return semi_token;
-        case '<':
-            Token *input_token = malloc(sizeof(Token));
-            input_token->type = TOKEN_INPUT_REDIR;
-            input_token->value = NULL;
-            lexer->position++;
-            return input_token;
-        case '>':
-            Token *output_token = malloc(sizeof(Token));
-            output_token->type = TOKEN_OUTPUT_REDIR;
-            output_token->value = NULL;
-            lexer->position++;
-            return output_token;
+        case '|': return lexer_operator(lexer, TOKEN_PIPE, 1);
+        case '&': return lexer_operator(lexer, TOKEN_BACKGROUND, 1);
+        case ';': return lexer_operator(lexer, TOKEN_SEMICOLON, 1);
+        case '\n': return lexer_operator(lexer, TOKEN_NEWLINE, 1);
+        case '<': return lexer_operator(lexer, TOKEN_INPUT_REDIR, 1);
+        case '>': return lexer_operator(lexer, TOKEN_OUTPUT_REDIR, 1);
         case '(':
-            Token *lparen_token = malloc(sizeof(Token));
-            lparen_token->type = TOKEN_LPAREN;
-            lparen_token->value = NULL;
-            lexer->position++;
-            return lparen_token;
+            if (lexer->depth++ == 0) lexer->paren_position = lexer->position;
+            return lexer_operator(lexer, TOKEN_LPAREN, 1);
         case ')':
-            Token *rparen_token = malloc(sizeof(Token));
-            rparen_token->type = TOKEN_RPAREN;
-            rparen_token->value = NULL;
-            lexer->position++;
-            return rparen_token;
+            if (--lexer->depth < 0) {
+                return lexer_error(lexer, LEX_UNBALANCED_PAREN, lexer->position);
+            }
+            return lexer_operator(lexer, TOKEN_RPAREN, 1);
     }
 
     if (isgraph(current)) {
-        char *value = lexer_read_word(lexer);
-
-        Token *token = malloc(sizeof(Token));
-        token->type = TOKEN_COMMAND;
-        token->value = value;
+        lexer_read_word(lexer, &token);
         return token;
     }
 
-    fprintf(stderr, "Error: Unknown symbol %c\n", current);
-    exit(EXIT_FAILURE);
+    return lexer_error(lexer, LEX_UNKNOWN_SYMBOL, lexer->position);
+}
+
+/* Reads the body of a here-document, which starts at the current position,
+ * the line after its operator. The body ends before the first line equal to
+ * delimiter, or that line with its leading tabs removed for '<<-'. Returns
+ * false, leaving the position alone, if the input ends first. */
+bool lexer_read_heredoc(Lexer *lexer, const char *delimiter, bool strip_tabs, Token *body) {
+    size_t delimiter_length = strlen(delimiter);
+    int line = lexer->position;
+
+    while (line < lexer->length) {
+        const char *newline = memchr(lexer->input + line, '\n', lexer->length - line);
+        int end = newline ? newline - lexer->input : lexer->length;
+        int start = line;
+        if (strip_tabs) {
+            while (start < end && lexer->input[start] == '\t') start++;
+        }
+        if ((size_t)(end - start) == delimiter_length && !memcmp(lexer->input + start, delimiter, delimiter_length)) {
+            body->type = TOKEN_HEREDOC_BODY;
+            body->offset = lexer->position;
+            body->length = line - lexer->position;
+            lexer->position = newline ? end + 1 : end;
+            return true;
+        }
+        if (!newline) break;
+        line = end + 1;
+    }
+    return false;
 }
 
-void free_token(Token *token) {
-    if (token->value) free(token->value);
-    free(token);
+const char *lex_error_message(LexErrorType type) {
+    switch (type) {
+        case LEX_OK: return "no error";
+        case LEX_UNCLOSED_QUOTE: return "unclosed quote";
+        case LEX_UNCLOSED_SUBSTITUTION: return "unclosed substitution";
+        case LEX_UNBALANCED_PAREN: return "imbalanced brackets";
+        case LEX_UNCLOSED_HEREDOC: return "unclosed here-document";
+        case LEX_UNKNOWN_SYMBOL: return "unknown symbol";
+    }
+    return "unknown error";
 }
 
 void test_lexer(const char *input) {
-    Lexer *lexer = lexer_init(input);
-    Token *token;
-    int token_type;
+    Lexer lexer;
+    Token token;
+
+    lexer_init(&lexer, input);
 
     printf("Lexer string testing: \"%s\"\n", input);
     do {
-        token = lexer_next_token(lexer);
-        token_type = token->type;
+        token = lexer_next_token(&lexer);
         printf("Token: ");
-        switch (token_type) {
-            case TOKEN_COMMAND: printf("COMMAND '%s'", token->value); break;
+        switch (token.type) {
+            case TOKEN_COMMAND: printf("COMMAND '%.*s'", token.length, input + token.offset); break;
             case TOKEN_AND: printf("AND"); break;
             case TOKEN_OR: printf("OR"); break;
             case TOKEN_PIPE: printf("PIPE"); break;
@@ -183,14 +300,17 @@ void test_lexer(const char *input) {
             case TOKEN_INPUT_REDIR: printf("INPUT_REDIR"); break;
             case TOKEN_OUTPUT_REDIR: printf("OUTPUT_REDIR"); break;
             case TOKEN_APPEND_REDIR: printf("APPEND_REDIR"); break;
+            case TOKEN_HEREDOC: printf("HEREDOC"); break;
+            case TOKEN_HERESTRING: printf("HERESTRING"); break;
+            case TOKEN_HEREDOC_BODY: printf("HEREDOC_BODY"); break;
             case TOKEN_LPAREN: printf("LPAREN"); break;
             case TOKEN_RPAREN: printf("RPAREN"); break;
+            case TOKEN_NEWLINE: printf("NEWLINE"); break;
             case TOKEN_EOF: printf("EOF"); break;
+            case TOKEN_ERROR: printf("ERROR %s at %d", lex_error_message(lexer.error.type), lexer.error.position); break;
             default: printf("UNKNOWN"); break;
         }
         printf("\n");
-        free_token(token);
-    } while (token_type != TOKEN_EOF);
+    } while (token.type != TOKEN_EOF && token.type != TOKEN_ERROR);
     printf("\n");
-    free_lexer(lexer);
 }
\ No newline at end of file
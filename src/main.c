@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "executor.h"
+#include "input.h"
+#include "variables.h"
+#include "trace.h"
+#include "server.h"
+
+extern char **environ;
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-c command | script | --server socket [workers] | --client socket command]\n",
+            name);
+}
+
+/* After -c, the next argument names the shell ($0) and the rest become
+ * $1...; a script gets its own name as $0. */
+static void set_params(char *name, char **values, int count) {
+    shell_params.name = name;
+    shell_params.values = values;
+    shell_params.count = count > 0 ? count : 0;
+}
+
+int main(int argc, char **argv) {
+    Input input;
+
+    shell_pid = getpid();
+    vars_init(environ);
+    trace_init();
+
+    if (argc > 1 && (!strcmp("--server", argv[1]) || !strcmp("--client", argv[1]))) {
+        bool server = !strcmp("--server", argv[1]);
+        if (argc < (server ? 3 : 4)) {
+            usage(argv[0]);
+            return 2;
+        }
+        if (server) return server_run(argv[2], argc > 3 ? atoi(argv[3]) : SERVER_DEFAULT_WORKERS);
+        return client_run(argv[2], argv[3]);
+    }
+
+    if (argc > 1 && !strcmp("-c", argv[1])) {
+        if (argc < 3) {
+            usage(argv[0]);
+            return 2;
+        }
+        input_open_string(&input, argv[2]);
+        set_params(argc > 3 ? argv[3] : argv[0], argv + (argc > 3 ? 4 : 3), argc - 4);
+    }
+    else if (argc > 1) {
+        if (!input_open_file(&input, argv[1])) {
+            perror(argv[1]);
+            return 127;
+        }
+        set_params(argv[1], argv + 2, argc - 2);
+    }
+    else {
+        input_open_fd(&input, STDIN_FILENO);
+        set_params(argv[0], argv + 1, argc - 1);
+    }
+
+    int status = shell_loop(&input);
+    input_close(&input);
+    return status;
+}
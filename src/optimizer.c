@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <string.h>
+#include "optimizer.h"
+#include "builtins.h"
+#include "functions.h"
+
+static bool has_input(ASTNode *node) {
+    return node->input_file || node->here_text;
+}
+
+static bool has_redirections(ASTNode *node) {
+    return has_input(node) || node->output_file;
+}
+
+/* A command that would be spawned as an external program. */
+static bool is_external(ASTNode *node) {
+    return node && node->type == NODE_COMMAND && !node->expand && !find_builtin(node->args[0]) &&
+            !function_find(node->args[0]);
+}
+
+static bool is_plain_builtin(ASTNode *node, const char *name) {
+    return node && node->type == NODE_COMMAND && !strcmp(node->args[0], name) && !node->args[1] &&
+            !has_redirections(node) && !function_find(name);
+}
+
+/* Wraps a rewrite so that it only stands while none of the names it relied
+ * on is a function; original is the tree as written. */
+static ASTNode *guard(Arena *arena, ASTNode *rewritten, ASTNode *original, char **names, int count) {
+    ASTNode *node = create_node(arena, NODE_GUARD, rewritten, original);
+    node->args = arena_alloc(arena, (count + 1) * sizeof(char *));
+    memcpy(node->args, names, count * sizeof(char *));
+    node->args[count] = NULL;
+    return node;
+}
+
+/* 'cat FILE' or 'cat < FILE' with no options: a pipeline stage that only
+ * copies one file. Returns the file. */
+static char *plain_cat_file(ASTNode *node) {
+    if (!node || node->type != NODE_COMMAND || node->expand || strcmp(node->args[0], "cat") ||
+            function_find("cat") || node->output_file) {
+        return NULL;
+    }
+    if (node->input_file) return node->args[1] ? NULL : node->input_file;
+    if (!node->args[1] || node->args[2] || node->args[1][0] == '-') return NULL;
+    return node->args[1];
+}
+
+/* cat FILE | CMD ... becomes CMD < FILE ... when CMD is an external
+ * command. A builtin alone would run in the shell process, where it could
+ * change shell state it could not change in a pipeline, and a compound
+ * stage has no command of its own to take the redirection. */
+static ASTNode *optimize_pipeline(Arena *arena, ASTNode *node) {
+    ASTNode *first = node->children[0];
+    ASTNode *second = node->children[1];
+    char *file = plain_cat_file(first);
+
+    if (!file || !is_external(second) || has_input(second)) return node;
+
+    char *names[] = { first->args[0], second->args[0] };
+    ASTNode *original = ast_clone(arena, node);
+    second->input_file = file;
+    if (node->child_count == 2) return guard(arena, second, original, names, 2);
+
+    memmove(node->children, node->children + 1, (node->child_count - 1) * sizeof(ASTNode *));
+    node->child_count--;
+    return guard(arena, node, original, names, 1);
+}
+
+/* (CMD) or (A | B) of external commands needs no extra shell process. */
+static ASTNode *optimize_subshell(Arena *arena, ASTNode *node) {
+    ASTNode *inner = node->left;
+    if (!inner) return node;
+
+    if (is_external(inner)) {
+        if ((has_input(node) && has_input(inner)) || (node->output_file && inner->output_file)) return node;
+        ASTNode *original = ast_clone(arena, node);
+        inner->expand = node->expand;
+        if (node->input_file) inner->input_file = node->input_file;
+        if (node->here_text) {
+            inner->here_text = node->here_text;
+            inner->here = node->here;
+        }
+        if (node->output_file) {
+            inner->output_file = node->output_file;
+            inner->append = node->append;
+        }
+        return guard(arena, inner, original, inner->args, 1);
+    }
+
+    if (inner->type == NODE_PIPE && !has_redirections(node)) {
+        char **names = arena_alloc(arena, inner->child_count * sizeof(char *));
+        for (int i = 0; i < inner->child_count; ++i) {
+            if (!is_external(inner->children[i])) return node;
+            names[i] = inner->children[i]->args[0];
+        }
+        return guard(arena, inner, node, names, inner->child_count);
+    }
+    return node;
+}
+
+/* true && X is X, false || X is X; true || X and false && X never run X. */
+static ASTNode *optimize_and_or(Arena *arena, ASTNode *node) {
+    bool is_and = node->type == NODE_AND;
+    if (is_plain_builtin(node->left, is_and ? "true" : "false")) {
+        return guard(arena, node->right, node, node->left->args, 1);
+    }
+    if (is_plain_builtin(node->left, is_and ? "false" : "true")) {
+        return guard(arena, node->left, node, node->left->args, 1);
+    }
+    return node;
+}
+
+static int count_sequence(ASTNode *node) {
+    if (node->type != NODE_SEQUENCE) return 1;
+    if (node->child_count) return node->child_count;
+    return count_sequence(node->left) + count_sequence(node->right);
+}
+
+static void collect_sequence(ASTNode *node, ASTNode **children, int *count) {
+    if (node->type != NODE_SEQUENCE) children[(*count)++] = node;
+    else if (node->child_count) {
+        for (int i = 0; i < node->child_count; ++i) children[(*count)++] = node->children[i];
+    }
+    else {
+        collect_sequence(node->left, children, count);
+        collect_sequence(node->right, children, count);
+    }
+}
+
+/* Nested sequences become one node with a children array. */
+static ASTNode *flatten_sequence(Arena *arena, ASTNode *node) {
+    int total = count_sequence(node);
+    ASTNode *flat = create_node(arena, NODE_SEQUENCE, NULL, NULL);
+    flat->children = arena_alloc(arena, total * sizeof(ASTNode *));
+    collect_sequence(node, flat->children, &flat->child_count);
+    return flat;
+}
+
+ASTNode *optimize_ast(Arena *arena, ASTNode *node) {
+    if (!node) return NULL;
+
+    node->left = optimize_ast(arena, node->left);
+    node->right = optimize_ast(arena, node->right);
+    for (int i = 0; i < node->child_count; ++i) node->children[i] = optimize_ast(arena, node->children[i]);
+
+    switch (node->type) {
+        case NODE_PIPE: return optimize_pipeline(arena, node);
+        case NODE_SUBSHELL: return optimize_subshell(arena, node);
+        case NODE_AND:
+        case NODE_OR: return optimize_and_or(arena, node);
+        case NODE_SEQUENCE: return flatten_sequence(arena, node);
+        default: return node;
+    }
+}
@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "output.h"
+
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+    bool capturing;
+    /* Flush at each newline; decided when the buffer starts to fill, since
+     * the descriptor may have been redirected since the last flush. */
+    bool line_buffered;
+} OutputBuffer;
+
+static OutputBuffer buffers[OUTPUT_MAX_FD];
+
+/* The descriptor whose buffer holds data, or -1. */
+static int pending_fd = -1;
+
+/* Writes both pieces, retrying after partial writes. Output that cannot be
+ * written is dropped, as stdio would. */
+static int write_vector(int fd, const char *first, size_t first_length, const char *second,
+        size_t second_length) {
+    struct iovec iov[2] = { { (void *)first, first_length }, { (void *)second, second_length } };
+    struct iovec *next = iov;
+    int count = 2;
+    while (count && !next->iov_len) {
+        next++;
+        count--;
+    }
+
+    while (count) {
+        ssize_t n = writev(fd, next, count);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        while (count && (size_t)n >= next->iov_len) {
+            n -= next->iov_len;
+            next++;
+            count--;
+        }
+        if (count) {
+            next->iov_base = (char *)next->iov_base + n;
+            next->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+int output_flush(int fd) {
+    if (fd < 0 || fd >= OUTPUT_MAX_FD) return 0;
+    OutputBuffer *buffer = &buffers[fd];
+    if (buffer->capturing || !buffer->length) return 0;
+
+    int result = write_vector(fd, buffer->data, buffer->length, NULL, 0);
+    buffer->length = 0;
+    if (pending_fd == fd) pending_fd = -1;
+    return result;
+}
+
+void output_flush_all(void) {
+    if (pending_fd >= 0) output_flush(pending_fd);
+}
+
+static void grow(OutputBuffer *buffer, size_t length) {
+    if (buffer->length + length <= buffer->capacity) return;
+    size_t capacity = buffer->capacity ? buffer->capacity : OUTPUT_BUFFER_SIZE;
+    while (buffer->length + length > capacity) capacity *= 2;
+    buffer->data = realloc(buffer->data, capacity);
+    buffer->capacity = capacity;
+}
+
+void output_write(int fd, const char *data, size_t length) {
+    if (fd < 0 || fd >= OUTPUT_MAX_FD) {
+        output_flush_all();
+        write_vector(fd, data, length, NULL, 0);
+        return;
+    }
+
+    OutputBuffer *buffer = &buffers[fd];
+    if (buffer->capturing) {
+        grow(buffer, length);
+        memcpy(buffer->data + buffer->length, data, length);
+        buffer->length += length;
+        return;
+    }
+
+    if (pending_fd != fd) {
+        output_flush_all();
+        buffer->line_buffered = isatty(fd);
+    }
+    if (buffer->length + length > OUTPUT_BUFFER_SIZE) {
+        write_vector(fd, buffer->data, buffer->length, data, length);
+        buffer->length = 0;
+        pending_fd = -1;
+        return;
+    }
+
+    grow(buffer, length);
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+    pending_fd = fd;
+    if (fd == STDERR_FILENO || (buffer->line_buffered && memchr(data, '\n', length))) output_flush(fd);
+}
+
+void output_puts(int fd, const char *text) {
+    output_write(fd, text, strlen(text));
+}
+
+void output_putc(int fd, char c) {
+    output_write(fd, &c, 1);
+}
+
+void output_printf(int fd, const char *format, ...) {
+    char small[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(small, sizeof(small), format, args);
+    va_end(args);
+    if (length < 0) return;
+    if ((size_t)length < sizeof(small)) {
+        output_write(fd, small, length);
+        return;
+    }
+
+    char *text = malloc(length + 1);
+    va_start(args, format);
+    vsnprintf(text, length + 1, format, args);
+    va_end(args);
+    output_write(fd, text, length);
+    free(text);
+}
+
+void output_perror(const char *prefix) {
+    output_printf(STDERR_FILENO, "%s: %s\n", prefix, strerror(errno));
+}
+
+void output_capture_begin(int fd) {
+    output_flush(fd);
+    buffers[fd].capturing = true;
+}
+
+void output_capture_end(int fd, char **text, size_t *length) {
+    OutputBuffer *buffer = &buffers[fd];
+    *text = malloc(buffer->length + 1);
+    if (buffer->length) memcpy(*text, buffer->data, buffer->length);
+    (*text)[buffer->length] = '\0';
+    *length = buffer->length;
+    buffer->length = 0;
+    buffer->capturing = false;
+}
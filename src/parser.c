@@ -1,100 +1,165 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <ctype.h>
 #include "parser.h"
+#include "scan.h"
+#include "output.h"
+
+static Token *push_token(TokenArray *array) {
+    if (array->length == array->capacity) {
+        Token *grown = arena_alloc(array->arena, array->capacity * 2 * sizeof(Token));
+        memcpy(grown, array->tokens, array->length * sizeof(Token));
+        array->tokens = grown;
+        array->capacity *= 2;
+    }
+    return &array->tokens[array->length++];
+}
 
-bool has_unclosed_quotes(const char *str) {
-    bool in_single_quotes = false;
-    bool in_double_quotes = false;
-    bool escape_next = false;
-
-    for (int i = 0; str[i]; ++i) {
-        if (escape_next) {
-            escape_next = false;
-            continue;
-        }
-        if (str[i] == '\\') {
-            escape_next = true;
-            continue;
-        }
-        if (str[i] == '\'' && !in_double_quotes) {
-            in_single_quotes = !in_single_quotes;
-        }
-        else if (str[i] == '"' && !in_single_quotes) {
-            in_double_quotes = !in_double_quotes;
+/* Fills the body tokens of the here-documents started on the line that a
+ * newline token at the lexer's position ends, in the order of their
+ * operators. */
+static bool read_heredocs(TokenArray *array, Lexer *lexer, int from) {
+    for (int i = from; i < array->length; ++i) {
+        Token *body = &array->tokens[i];
+        if (body->type != TOKEN_HEREDOC_BODY || body->length >= 0) continue;
+        Token *operator = body - 2;
+        bool strip_tabs = operator->length == 3;
+        if (!lexer_read_heredoc(lexer, token_text(array, body - 1), strip_tabs, body)) {
+            lexer->error.type = LEX_UNCLOSED_HEREDOC;
+            lexer->error.position = operator->offset;
+            return false;
         }
     }
-    return in_single_quotes || in_double_quotes;
+    return true;
 }
 
-bool has_imbalanced_brackets(const char *str) {
-    bool in_single_quotes = false;
-    bool in_double_quotes = false;
-    bool escape_next = false;
-    int depth = 0;
+TokenArray *tokenize(Arena *arena, const char *input) {
+    Lexer lexer;
+    lexer_init(&lexer, input);
 
-    for (int i = 0; str[i]; ++i) {
-        if (escape_next) {
-            escape_next = false;
-            continue;
+    TokenArray *array = arena_alloc(arena, sizeof(TokenArray));
+    array->arena = arena;
+    array->input = input;
+    array->capacity = 16;
+    array->tokens = arena_alloc(arena, array->capacity * sizeof(Token));
+    array->length = 0;
+    array->position = 0;
+
+    /* A here-document's delimiter is followed by a body token, filled in
+     * once the line ends; the body is not tokenized. */
+    int heredocs = 0;
+    int line_start = 0;
+    TokenType type;
+    do {
+        Token *token = push_token(array);
+        *token = lexer_next_token(&lexer);
+        type = token->type;
+
+        if (type == TOKEN_COMMAND && array->length > 1 && token[-1].type == TOKEN_HEREDOC) {
+            int offset = token->offset + token->length;
+            Token *body = push_token(array);
+            body->type = TOKEN_HEREDOC_BODY;
+            body->offset = offset;
+            body->length = -1;
+            heredocs++;
         }
-        if (str[i] == '\\') {
-            escape_next = true;
-            continue;
+        else if ((type == TOKEN_NEWLINE || type == TOKEN_EOF) && heredocs) {
+            if (!read_heredocs(array, &lexer, line_start)) token->type = type = TOKEN_ERROR;
+            heredocs = 0;
         }
-        if (str[i] == '\'' && !in_double_quotes) {
-            in_single_quotes = !in_single_quotes;
+        if (type == TOKEN_NEWLINE) line_start = array->length;
+    } while (type != TOKEN_EOF && type != TOKEN_ERROR);
+
+    array->error = lexer.error;
+    array->parse_error = NULL;
+    /* Input that ends inside a quote, a substitution, a subshell or a
+     * here-document may be finished by the next line. */
+    array->incomplete = lexer.error.type == LEX_UNCLOSED_QUOTE ||
+            lexer.error.type == LEX_UNCLOSED_SUBSTITUTION || lexer.error.type == LEX_UNCLOSED_HEREDOC ||
+            (lexer.error.type == LEX_UNBALANCED_PAREN && lexer.depth > 0);
+    return array;
+}
+
+void print_lex_error(TokenArray *array) {
+    fprintf(stderr, "Error: %s at position %d\n",
+            lex_error_message(array->error.type), array->error.position + 1);
+}
+
+char *token_text(TokenArray *array, Token *token) {
+    const char *word = array->input + token->offset;
+    if (!memchr(word, '"', token->length) && !memchr(word, '\'', token->length) &&
+            !memchr(word, '\\', token->length)) {
+        return arena_strndup(array->arena, word, token->length);
+    }
+
+    char *text = arena_alloc(array->arena, token->length + 1);
+    char quote = 0;
+    int length = 0;
+    for (int i = 0; i < token->length; ++i) {
+        char c = word[i];
+        if (quote == '\'') {
+            if (c == quote) quote = 0;
+            else text[length++] = c;
         }
-        else if (str[i] == '"' && !in_single_quotes) {
-            in_double_quotes = !in_double_quotes;
+        else if (c == '\\' && i + 1 < token->length) {
+            char next = word[i + 1];
+            if (quote == '"' && !strchr("\"\\$`", next)) text[length++] = c;
+            text[length++] = next;
+            ++i;
         }
-        if (in_single_quotes || in_double_quotes) continue;
-        if (str[i] == '(') ++depth;
-        else if (str[i] == ')') {
-            if (--depth < 0) return true;
+        else if (quote == '"') {
+            if (c == quote) quote = 0;
+            else text[length++] = c;
         }
+        else if (c == '"' || c == '\'') quote = c;
+        else text[length++] = c;
     }
-    return depth != 0;
+    text[length] = '\0';
+    return text;
 }
 
-TokenArray *tokenize(const char *input) {
-    if (has_unclosed_quotes(input)) {
-        fprintf(stderr, "Error: unclosed quote\n");
-        exit(EXIT_FAILURE);
-    }
-
-    if (has_imbalanced_brackets(input)) {
-        fprintf(stderr, "Error: imbalanced brackets\n");
-        exit(EXIT_FAILURE);
+/* Command words keep their quotes and substitutions; the executor expands
+ * them when the command runs, along with pathname patterns and process
+ * substitutions, the only unquoted operators a word holds. Plain words need
+ * no expansion at all, which node->expand records for the whole node. */
+static char *word_text(TokenArray *array, Token *token, ASTNode *node) {
+    const char *word = array->input + token->offset;
+    for (int i = 0; i < token->length; ++i) {
+        if (scan_class[(unsigned char)word[i]] & (SCAN_OPERATOR | SCAN_QUOTE | SCAN_EXPAND | SCAN_GLOB)) {
+            node->expand = true;
+            break;
+        }
     }
+    return arena_strndup(array->arena, word, token->length);
+}
 
-    Lexer *lexer = lexer_init(input);
-    TokenArray *array = malloc(sizeof(TokenArray));
-    array->tokens = NULL;
-    array->length = 0;
-    array->position = 0;
+/* NAME=value before the command name. */
+static bool is_assignment(TokenArray *array, Token *token) {
+    const char *word = array->input + token->offset;
+    int i = 0;
+    if (!(isalpha((unsigned char)word[0]) || word[0] == '_')) return false;
+    while (i < token->length && (isalnum((unsigned char)word[i]) || word[i] == '_')) i++;
+    return i < token->length && word[i] == '=';
+}
 
-    Token *token;
-    do {
-        token = lexer_next_token(lexer);
-        array->tokens = realloc(array->tokens, (array->length + 1) * sizeof(Token));
-        array->tokens[array->length] = *token;
-        if (token->value) {
-            array->tokens[array->length].value = strdup(token->value); 
-        }
-        free_token(token);
-    } while (array->tokens[array->length++].type != TOKEN_EOF);
+void print_parse_error(TokenArray *array) {
+    fprintf(stderr, "Error: %s\n", array->parse_error);
+}
 
-    free_lexer(lexer);
-    return array;
+/* Records the first syntax error and stops the parse by moving to the EOF
+ * token. An error at EOF marks the input as incomplete rather than wrong. */
+static void parse_fail(TokenArray *array, Token *token, const char *message) {
+    if (array->parse_error) return;
+    array->parse_error = message;
+    array->incomplete = !token || token->type == TOKEN_EOF;
+    array->position = array->length - 1;
 }
 
-void free_token_array(TokenArray *array) {
-    for (int i = 0; i < array->length; ++i) {
-        if (array->tokens[i].value) free(array->tokens[i].value);
-    }
-    free(array->tokens);
-    free(array);
+static void skip_newlines(TokenArray *array) {
+    Token *token;
+    while ((token = peek_token(array)) && token->type == TOKEN_NEWLINE) next_token(array);
 }
 
 Token *peek_token(TokenArray *array) {
@@ -107,92 +172,352 @@ Token *next_token(TokenArray *array) {
     return &array->tokens[array->position++];
 }
 
-ASTNode *create_node(NodeType type, ASTNode *left, ASTNode *right) {
-    ASTNode *node = malloc(sizeof(ASTNode));
+static ASTNode *parse_list(TokenArray *array);
+
+ASTNode *create_node(Arena *arena, NodeType type, ASTNode *left, ASTNode *right) {
+    ASTNode *node = arena_alloc(arena, sizeof(ASTNode));
     node->type = type;
     node->left = left;
     node->right = right;
+    node->children = NULL;
+    node->child_count = 0;
     node->args = NULL;
     node->input_file = NULL;
+    node->here_text = NULL;
+    node->here = HERE_NONE;
     node->output_file = NULL;
     node->append = 0;
+    node->name = NULL;
+    node->expand = false;
+    node->assignments = 0;
     return node;
 }
 
-ASTNode *parse_command(TokenArray *array) {
+/* Reserved words are only recognised unquoted and in command position. */
+static bool is_word(TokenArray *array, Token *token, const char *word) {
+    size_t length = strlen(word);
+    return token && token->type == TOKEN_COMMAND && (size_t)token->length == length &&
+            !memcmp(array->input + token->offset, word, length);
+}
+
+static bool is_list_end(TokenArray *array, Token *token) {
+    static const char *const terminators[] = { "then", "elif", "else", "fi", "do", "done", "}" };
+    if (!token || token->type == TOKEN_EOF || token->type == TOKEN_RPAREN) return true;
+    for (size_t i = 0; i < sizeof(terminators) / sizeof(terminators[0]); ++i) {
+        if (is_word(array, token, terminators[i])) return true;
+    }
+    return false;
+}
+
+static bool expect_word(TokenArray *array, const char *word) {
+    skip_newlines(array);
     Token *token = next_token(array);
-    if (!token) return NULL;
+    if (is_word(array, token, word)) return true;
+
+    char *message = arena_alloc(array->arena, strlen(word) + 16);
+    sprintf(message, "expected '%s'", word);
+    parse_fail(array, token, message);
+    return false;
+}
+
+/* Parses a list that must not be empty, such as a loop body. */
+static ASTNode *parse_body(TokenArray *array) {
+    ASTNode *body = parse_list(array);
+    if (!body) parse_fail(array, peek_token(array), "expected command");
+    return body;
+}
+
+static bool is_redirection(Token *token) {
+    return token && (token->type == TOKEN_INPUT_REDIR || token->type == TOKEN_OUTPUT_REDIR ||
+            token->type == TOKEN_APPEND_REDIR || token->type == TOKEN_HEREDOC || token->type == TOKEN_HERESTRING);
+}
+
+/* The body as read on stdin: leading tabs go for '<<-'. A quoted delimiter
+ * keeps the body as written; otherwise it is expanded when it holds
+ * anything to expand. */
+static void heredoc_text(TokenArray *array, Token *operator, Token *delimiter, Token *body, ASTNode *node) {
+    const char *text = array->input + body->offset;
+    char *copy = arena_alloc(array->arena, body->length + 1);
+    int length = 0;
+    bool line_start = true;
+    for (int i = 0; i < body->length; ++i) {
+        if (line_start && operator->length == 3 && text[i] == '\t') continue;
+        line_start = text[i] == '\n';
+        copy[length++] = text[i];
+    }
+    copy[length] = '\0';
+
+    const char *word = array->input + delimiter->offset;
+    bool quoted = false;
+    for (int i = 0; i < delimiter->length; ++i) {
+        if (scan_class[(unsigned char)word[i]] & SCAN_QUOTE) quoted = true;
+    }
+    node->here_text = copy;
+    node->here = !quoted && strpbrk(copy, "$`\\") ? HERE_DOCUMENT : HERE_LITERAL;
+    if (node->here == HERE_DOCUMENT) node->expand = true;
+}
+
+static bool parse_redirection(TokenArray *array, ASTNode *node) {
+    Token *operator = next_token(array);
+    int is_append = (operator->type == TOKEN_APPEND_REDIR);
+    bool is_input = (operator->type == TOKEN_INPUT_REDIR);
+
+    Token *token = next_token(array);
+    if (!token || token->type != TOKEN_COMMAND) {
+        parse_fail(array, token, operator->type == TOKEN_HEREDOC ? "expected delimiter after '<<'" :
+                operator->type == TOKEN_HERESTRING ? "expected word after '<<<'" :
+                is_input ? "expected filename after '<'" :
+                is_append ? "expected filename after '>>'" : "expected filename after '>'");
+        return false;
+    }
+    if (operator->type == TOKEN_HEREDOC) {
+        heredoc_text(array, operator, token, next_token(array), node);
+        node->input_file = NULL;
+    }
+    else if (operator->type == TOKEN_HERESTRING) {
+        node->here_text = word_text(array, token, node);
+        node->here = HERE_STRING;
+        node->input_file = NULL;
+    }
+    else if (is_input) {
+        node->input_file = word_text(array, token, node);
+        node->here_text = NULL;
+        node->here = HERE_NONE;
+    }
+    else {
+        node->output_file = word_text(array, token, node);
+        node->append = is_append;
+    }
+    return true;
+}
+
+/* Compound commands take redirections after their closing word. */
+static ASTNode *parse_compound_redirections(TokenArray *array, ASTNode *node) {
+    while (node && is_redirection(peek_token(array))) {
+        if (!parse_redirection(array, node)) return NULL;
+    }
+    return node;
+}
+
+static ASTNode *parse_if(TokenArray *array) {
+    ASTNode *node = create_node(array->arena, NODE_IF, NULL, NULL);
+    node->children = arena_alloc(array->arena, 3 * sizeof(ASTNode *));
+    node->children[0] = parse_body(array);
+    if (!expect_word(array, "then")) return NULL;
+    node->children[1] = parse_body(array);
+    node->child_count = 2;
+
+    skip_newlines(array);
+    Token *token = next_token(array);
+    if (is_word(array, token, "elif")) {
+        node->children[node->child_count++] = parse_if(array);
+        return array->parse_error ? NULL : node;
+    }
+    if (is_word(array, token, "else")) {
+        node->children[node->child_count++] = parse_body(array);
+        token = next_token(array);
+    }
+    if (!is_word(array, token, "fi")) {
+        parse_fail(array, token, "expected 'fi'");
+        return NULL;
+    }
+    return node;
+}
+
+static ASTNode *parse_loop(TokenArray *array, NodeType type) {
+    ASTNode *condition = parse_body(array);
+    if (!expect_word(array, "do")) return NULL;
+    ASTNode *body = parse_body(array);
+    if (!expect_word(array, "done")) return NULL;
+    return create_node(array->arena, type, condition, body);
+}
+
+/* for NAME [in WORD...]; do LIST; done. Without 'in' the loop runs over the
+ * positional parameters, marked by args being NULL. */
+static ASTNode *parse_for(TokenArray *array) {
+    Token *token = next_token(array);
+    if (!token || token->type != TOKEN_COMMAND) {
+        parse_fail(array, token, "expected variable name after 'for'");
+        return NULL;
+    }
+
+    ASTNode *node = create_node(array->arena, NODE_FOR, NULL, NULL);
+    node->name = token_text(array, token);
+
+    skip_newlines(array);
+    if (is_word(array, peek_token(array), "in")) {
+        next_token(array);
+        int count = 0;
+        while (array->tokens[array->position + count].type == TOKEN_COMMAND) count++;
+        node->args = arena_alloc(array->arena, (count + 1) * sizeof(char *));
+        for (int i = 0; i < count; ++i) node->args[i] = word_text(array, next_token(array), node);
+        node->args[count] = NULL;
+    }
+
+    token = peek_token(array);
+    if (token && token->type == TOKEN_SEMICOLON) next_token(array);
+    if (!expect_word(array, "do")) return NULL;
+    node->left = parse_body(array);
+    if (!expect_word(array, "done")) return NULL;
+    return node;
+}
+
+static ASTNode *parse_group(TokenArray *array) {
+    ASTNode *body = parse_body(array);
+    if (!expect_word(array, "}")) return NULL;
+    return create_node(array->arena, NODE_GROUP, body, NULL);
+}
+
+/* NAME () COMPOUND, or 'function NAME [()] COMPOUND'. */
+static ASTNode *parse_function(TokenArray *array, Token *name) {
+    Token *token = peek_token(array);
+    if (token && token->type == TOKEN_LPAREN) {
+        next_token(array);
+        token = next_token(array);
+        if (!token || token->type != TOKEN_RPAREN) {
+            parse_fail(array, token, "expected ')' in function definition");
+            return NULL;
+        }
+    }
+
+    skip_newlines(array);
+    token = peek_token(array);
+    if (!token || (token->type != TOKEN_LPAREN && !is_word(array, token, "{") &&
+            !is_word(array, token, "if") && !is_word(array, token, "while") &&
+            !is_word(array, token, "until") && !is_word(array, token, "for"))) {
+        parse_fail(array, token, "expected function body");
+        return NULL;
+    }
+
+    ASTNode *node = create_node(array->arena, NODE_FUNCTION, parse_command(array), NULL);
+    node->name = token_text(array, name);
+    return array->parse_error ? NULL : node;
+}
 
+static ASTNode *parse_compound(TokenArray *array, Token *token) {
     if (token->type == TOKEN_LPAREN) {
-        ASTNode *subshell = parse_expression(array);
+        ASTNode *subshell = parse_list(array);
         token = next_token(array);
-        return create_node(NODE_SUBSHELL, subshell, NULL);
+        if (!token || token->type != TOKEN_RPAREN) {
+            parse_fail(array, token, "expected ')'");
+            return NULL;
+        }
+        return create_node(array->arena, NODE_SUBSHELL, subshell, NULL);
+    }
+    if (is_word(array, token, "if")) return parse_if(array);
+    if (is_word(array, token, "while")) return parse_loop(array, NODE_WHILE);
+    if (is_word(array, token, "until")) return parse_loop(array, NODE_UNTIL);
+    if (is_word(array, token, "for")) return parse_for(array);
+    if (is_word(array, token, "{")) return parse_group(array);
+    if (is_word(array, token, "function")) {
+        Token *name = next_token(array);
+        if (!name || name->type != TOKEN_COMMAND) {
+            parse_fail(array, name, "expected function name");
+            return NULL;
+        }
+        return parse_function(array, name);
+    }
+
+    Token *next = peek_token(array);
+    if (next && next->type == TOKEN_LPAREN && array->tokens[array->position + 1].type == TOKEN_RPAREN) {
+        return parse_function(array, token);
+    }
+    return NULL;
+}
+
+ASTNode *parse_command(TokenArray *array) {
+    Token *token = next_token(array);
+    if (!token) return NULL;
+
+    if (token->type == TOKEN_LPAREN || token->type == TOKEN_COMMAND) {
+        int position = array->position;
+        ASTNode *compound = parse_compound(array, token);
+        if (compound || array->parse_error) return parse_compound_redirections(array, compound);
+        array->position = position;
     }
 
-    if (token->type != TOKEN_COMMAND) {
-        fprintf(stderr, "Error: expected command\n");
-        exit(EXIT_FAILURE);
+    if (token->type != TOKEN_COMMAND || is_list_end(array, token)) {
+        parse_fail(array, token, "expected command");
+        return NULL;
+    }
+
+    int args_capacity = 1;
+    for (int i = array->position; i < array->length; ++i) {
+        TokenType type = array->tokens[i].type;
+        if (type == TOKEN_COMMAND) args_capacity++;
+        else if (type == TOKEN_INPUT_REDIR || type == TOKEN_OUTPUT_REDIR || type == TOKEN_APPEND_REDIR ||
+                type == TOKEN_HERESTRING) i++;
+        else if (type == TOKEN_HEREDOC) i += 2;
+        else break;
     }
 
-    char **args = malloc(2 * sizeof(char *));
-    args[0] = strdup(token->value);
+    ASTNode *command_node = create_node(array->arena, NODE_COMMAND, NULL, NULL);
+    char **args = arena_alloc(array->arena, (args_capacity + 1) * sizeof(char *));
+    args[0] = word_text(array, token, command_node);
     args[1] = NULL;
     int args_count = 1;
-
-    ASTNode *command_node = create_node(NODE_COMMAND, NULL, NULL);
     command_node->args = args;
+    command_node->assignments = is_assignment(array, token);
 
     while ((token = peek_token(array))) {
-        if (token->type == TOKEN_INPUT_REDIR) {
-            next_token(array);
-            token = next_token(array);
-            if (!token || token->type != TOKEN_COMMAND) {
-                fprintf(stderr, "Error: expected filename after '<'\n");
-                exit(EXIT_FAILURE);
-            }
-            command_node->input_file = strdup(token->value);
-        }
-
-        else if (token->type == TOKEN_OUTPUT_REDIR || token->type == TOKEN_APPEND_REDIR) {
-            int is_append = (token->type == TOKEN_APPEND_REDIR);
-            next_token(array);
-            token = next_token(array);
-            if (!token || token->type != TOKEN_COMMAND) {
-                fprintf(stderr, "Error: expected filename after '%s'\n", is_append ? ">>" : ">");
-                exit(EXIT_FAILURE);
-            }
-            command_node->output_file = strdup(token->value);
-            command_node->append = is_append;
+        if (is_redirection(token)) {
+            if (!parse_redirection(array, command_node)) return NULL;
         }
 
         else if (token->type == TOKEN_COMMAND) {
             next_token(array);
-            args_count++;
-            args = realloc(args, (args_count + 1) * (sizeof(char *)));
-            args[args_count - 1] = strdup(token->value);
+            if (command_node->assignments == args_count && is_assignment(array, token)) command_node->assignments++;
+            args[args_count++] = word_text(array, token, command_node);
             args[args_count] = NULL;
-            command_node->args = args;
         }
 
         else break;
     }
 
+    /* Assignments change shell state, so the command is never spawned as
+     * written. */
+    if (command_node->assignments) command_node->expand = true;
     return command_node;
 }
 
+static bool is_separator(Token *token) {
+    return token->type == TOKEN_SEMICOLON || token->type == TOKEN_BACKGROUND || token->type == TOKEN_NEWLINE;
+}
+
 ASTNode *parse_pipeline(TokenArray *array) {
-    ASTNode *left = parse_command(array);
-    Token *token;
+    Token *token = peek_token(array);
+    if (is_word(array, token, "time")) {
+        next_token(array);
+        token = peek_token(array);
+        ASTNode *timed = is_list_end(array, token) || is_separator(token) ? NULL : parse_pipeline(array);
+        return create_node(array->arena, NODE_TIME, timed, NULL);
+    }
 
-    while ((token = peek_token(array))) {
-        if (token->type == TOKEN_PIPE) {
-            next_token(array);
-            ASTNode *right = parse_command(array);
-            left = create_node(NODE_PIPE, left, right);
+    ASTNode *first = parse_command(array);
+    token = peek_token(array);
+    if (!token || token->type != TOKEN_PIPE) return first;
+
+    int capacity = 4;
+    ASTNode **stages = arena_alloc(array->arena, capacity * sizeof(ASTNode *));
+    int count = 0;
+    stages[count++] = first;
+
+    while ((token = peek_token(array)) && token->type == TOKEN_PIPE) {
+        next_token(array);
+        skip_newlines(array);
+        if (count == capacity) {
+            ASTNode **grown = arena_alloc(array->arena, capacity * 2 * sizeof(ASTNode *));
+            memcpy(grown, stages, count * sizeof(ASTNode *));
+            stages = grown;
+            capacity *= 2;
         }
-        else break;
+        stages[count++] = parse_command(array);
     }
-    return left;
+
+    ASTNode *pipeline = create_node(array->arena, NODE_PIPE, NULL, NULL);
+    pipeline->children = stages;
+    pipeline->child_count = count;
+    return pipeline;
 }
 
 ASTNode *parse_and_or(TokenArray *array) {
@@ -203,8 +528,9 @@ ASTNode *parse_and_or(TokenArray *array) {
         if (token->type == TOKEN_AND || token->type == TOKEN_OR) {
             NodeType op_type = (token->type == TOKEN_AND) ? NODE_AND : NODE_OR;
             next_token(array);
+            skip_newlines(array);
             ASTNode *right = parse_pipeline(array);
-            left = create_node(op_type, left, right);
+            left = create_node(array->arena, op_type, left, right);
         }
         else break;
     }
@@ -212,99 +538,274 @@ ASTNode *parse_and_or(TokenArray *array) {
 }
 
 ASTNode *parse_sequence_background(TokenArray *array) {
-    ASTNode *left = parse_and_or(array);
+    ASTNode *left = NULL;
+    ASTNode *current = parse_and_or(array);
     Token *token;
 
-    while ((token = peek_token(array))) {
-        if (token->type == TOKEN_SEMICOLON) {
-            next_token(array);
-            Token *next = peek_token(array);
-            if (next && next->type != TOKEN_EOF) {
-                ASTNode *right = parse_and_or(array);
-                if (right) {
-                    left = create_node(NODE_SEQUENCE, left, right);
-                }
+    while ((token = peek_token(array)) && is_separator(token)) {
+        next_token(array);
+        Token *next = peek_token(array);
+        if (token->type == TOKEN_BACKGROUND) {
+            if (next && next->type == TOKEN_SEMICOLON) {
+                parse_fail(array, next, "unexpected token after '&'");
+                return NULL;
             }
-            else break;
+            current = create_node(array->arena, NODE_BACKGROUND, current, NULL);
         }
-        else if (token->type == TOKEN_BACKGROUND) {
-            next_token(array);
-            Token *next = peek_token(array);
-            if (next && next->type != TOKEN_EOF) {
-                if (next->type == TOKEN_SEMICOLON) {
-                   fprintf(stderr, "Error: unexpected token after '&'\n");
-                    exit(EXIT_FAILURE);
-                }
-                ASTNode *right = parse_and_or(array);
-                if (right) {
-                    left = create_node(NODE_SEQUENCE, create_node(NODE_BACKGROUND, left, NULL), right);
-                }
-            }
-            else left = create_node(NODE_BACKGROUND, left, NULL);
-        }
-        else break;
+
+        left = left ? create_node(array->arena, NODE_SEQUENCE, left, current) : current;
+        current = NULL;
+        skip_newlines(array);
+        if (is_list_end(array, peek_token(array))) break;
+        current = parse_and_or(array);
     }
-    return left;
+
+    if (!current) return left;
+    return left ? create_node(array->arena, NODE_SEQUENCE, left, current) : current;
+}
+
+static ASTNode *parse_list(TokenArray *array) {
+    skip_newlines(array);
+    if (is_list_end(array, peek_token(array))) return NULL;
+    return parse_sequence_background(array);
 }
 
+/* Parses a whole command line; anything left over after the list is a
+ * syntax error. Returns NULL on errors, see array->parse_error. */
 ASTNode *parse_expression(TokenArray *array) {
+    ASTNode *node = parse_list(array);
     Token *token = peek_token(array);
-    if (!token || token->type == TOKEN_EOF) {
-        return NULL;
+    if (token && token->type != TOKEN_EOF) parse_fail(array, token, "unexpected token");
+    return array->parse_error ? NULL : node;
+}
+
+/* Deep-copies a tree into arena so it can outlive the line it was parsed
+ * from. */
+ASTNode *ast_clone(Arena *arena, ASTNode *node) {
+    if (!node) return NULL;
+
+    ASTNode *copy = create_node(arena, node->type, ast_clone(arena, node->left),
+            ast_clone(arena, node->right));
+    if (node->args) {
+        int count = 0;
+        while (node->args[count]) count++;
+        copy->args = arena_alloc(arena, (count + 1) * sizeof(char *));
+        for (int i = 0; i < count; ++i) copy->args[i] = arena_strdup(arena, node->args[i]);
+        copy->args[count] = NULL;
     }
-    return parse_sequence_background(array);
+    if (node->child_count) {
+        copy->children = arena_alloc(arena, node->child_count * sizeof(ASTNode *));
+        for (int i = 0; i < node->child_count; ++i) copy->children[i] = ast_clone(arena, node->children[i]);
+        copy->child_count = node->child_count;
+    }
+    if (node->input_file) copy->input_file = arena_strdup(arena, node->input_file);
+    if (node->here_text) copy->here_text = arena_strdup(arena, node->here_text);
+    if (node->output_file) copy->output_file = arena_strdup(arena, node->output_file);
+    if (node->name) copy->name = arena_strdup(arena, node->name);
+    copy->append = node->append;
+    copy->here = node->here;
+    copy->expand = node->expand;
+    copy->assignments = node->assignments;
+    return copy;
 }
 
-void free_ast(ASTNode *node) {
-    if (!node) return;
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} StringBuilder;
+
+static void sb_append(StringBuilder *sb, const char *text) {
+    size_t length = strlen(text);
+    if (sb->length + length + 1 > sb->capacity) {
+        while (sb->length + length + 1 > sb->capacity) sb->capacity = sb->capacity ? sb->capacity * 2 : 64;
+        sb->data = realloc(sb->data, sb->capacity);
+    }
+    memcpy(sb->data + sb->length, text, length + 1);
+    sb->length += length;
+}
 
-    if (node->left && node->left != node) free_ast(node->left);
-    if (node->right && node->right != node) free_ast(node->right);
+static void format_ast(StringBuilder *sb, ASTNode *node);
 
-    if (node->args) {
-        for (int i = 0; node->args[i]; ++i) free(node->args[i]);
-        free(node->args);
+/* Here-documents show as a placeholder; their bodies would span lines. */
+static void format_redirections(StringBuilder *sb, ASTNode *node) {
+    if (node->input_file) {
+        sb_append(sb, " < ");
+        sb_append(sb, node->input_file);
+    }
+    if (node->here == HERE_STRING) {
+        sb_append(sb, " <<< ");
+        sb_append(sb, node->here_text);
+    }
+    else if (node->here_text) sb_append(sb, " <<...");
+    if (node->output_file) {
+        sb_append(sb, node->append ? " >> " : " > ");
+        sb_append(sb, node->output_file);
+    }
+}
+
+/* Writes a list followed by the separator a reserved word needs. */
+static void format_list(StringBuilder *sb, ASTNode *node, const char *before) {
+    sb_append(sb, before);
+    format_ast(sb, node);
+    sb_append(sb, node && node->type == NODE_BACKGROUND ? " " : "; ");
+}
+
+static void format_ast(StringBuilder *sb, ASTNode *node) {
+    if (!node) return;
+
+    switch (node->type) {
+        case NODE_COMMAND:
+            for (int i = 0; node->args && node->args[i]; ++i) {
+                if (i) sb_append(sb, " ");
+                sb_append(sb, node->args[i]);
+            }
+            break;
+        case NODE_PIPE:
+            for (int i = 0; i < node->child_count; ++i) {
+                if (i) sb_append(sb, " | ");
+                format_ast(sb, node->children[i]);
+            }
+            break;
+        case NODE_SEQUENCE:
+            for (int i = 0; i < node->child_count; ++i) {
+                format_ast(sb, node->children[i]);
+                if (i < node->child_count - 1) {
+                    sb_append(sb, node->children[i]->type == NODE_BACKGROUND ? " " : "; ");
+                }
+            }
+            if (node->child_count) break;
+            /* fall through */
+        case NODE_AND:
+        case NODE_OR:
+            format_ast(sb, node->left);
+            if (node->type == NODE_AND) sb_append(sb, " && ");
+            else if (node->type == NODE_OR) sb_append(sb, " || ");
+            else sb_append(sb, node->left && node->left->type == NODE_BACKGROUND ? " " : "; ");
+            format_ast(sb, node->right);
+            break;
+        case NODE_BACKGROUND:
+            format_ast(sb, node->left);
+            sb_append(sb, " &");
+            break;
+        case NODE_SUBSHELL:
+            sb_append(sb, "(");
+            format_ast(sb, node->left);
+            sb_append(sb, ")");
+            break;
+        case NODE_GROUP:
+            format_list(sb, node->left, "{ ");
+            sb_append(sb, "}");
+            break;
+        case NODE_IF:
+            format_list(sb, node->children[0], "if ");
+            format_list(sb, node->children[1], "then ");
+            if (node->child_count > 2) format_list(sb, node->children[2], "else ");
+            sb_append(sb, "fi");
+            break;
+        case NODE_WHILE:
+        case NODE_UNTIL:
+            format_list(sb, node->left, node->type == NODE_WHILE ? "while " : "until ");
+            format_list(sb, node->right, "do ");
+            sb_append(sb, "done");
+            break;
+        case NODE_FOR:
+            sb_append(sb, "for ");
+            sb_append(sb, node->name);
+            if (node->args) sb_append(sb, " in");
+            for (int i = 0; node->args && node->args[i]; ++i) {
+                sb_append(sb, " ");
+                sb_append(sb, node->args[i]);
+            }
+            format_list(sb, node->left, "; do ");
+            sb_append(sb, "done");
+            break;
+        case NODE_FUNCTION:
+            sb_append(sb, node->name);
+            sb_append(sb, "() ");
+            format_ast(sb, node->left);
+            break;
+        case NODE_TIME:
+            sb_append(sb, node->left ? "time " : "time");
+            format_ast(sb, node->left);
+            break;
+        case NODE_GUARD:
+            format_ast(sb, node->right);
+            break;
+    }
+    if (node->type != NODE_PIPE && node->type != NODE_AND && node->type != NODE_OR &&
+            node->type != NODE_SEQUENCE && node->type != NODE_BACKGROUND && node->type != NODE_TIME) {
+        format_redirections(sb, node);
     }
+}
 
-    if (node->input_file) free(node->input_file);
-    if (node->output_file) free(node->output_file);
+char *ast_to_string(ASTNode *node) {
+    StringBuilder sb = { NULL, 0, 0 };
+    sb_append(&sb, "");
+    format_ast(&sb, node);
+    return sb.data;
+}
 
-    free(node);
+static void print_redirections(ASTNode *node) {
+    if (node->input_file) output_printf(STDOUT_FILENO, " < %s", node->input_file);
+    if (node->here == HERE_STRING) output_printf(STDOUT_FILENO, " <<< %s", node->here_text);
+    else if (node->here_text) output_printf(STDOUT_FILENO, " << (%zu bytes%s)", strlen(node->here_text),
+            node->here == HERE_DOCUMENT ? ", expanded" : "");
+    if (node->output_file) output_printf(STDOUT_FILENO, " %s %s", node->append ? ">>" : ">", node->output_file);
 }
 
 void print_ast(ASTNode *node, int level) {
     if (!node) return;
 
-    for (int i = 0; i < level; ++i) printf("  ");
+    for (int i = 0; i < level; ++i) output_puts(STDOUT_FILENO, "  ");
 
     switch (node->type) {
         case NODE_COMMAND:
-            printf("COMMAND:");
+            output_puts(STDOUT_FILENO, "COMMAND:");
             for (int i = 0; node->args && node->args[i]; ++i) {
-                printf(" %s", node->args[i]);
+                output_printf(STDOUT_FILENO, " %s", node->args[i]);
             }
-            if (node->input_file) printf(" < %s", node->input_file);
-            if (node->output_file) printf(" %s %s", node->append ? ">>" : ">", node->output_file);
+            print_redirections(node);
+            break;
+        case NODE_PIPE: output_puts(STDOUT_FILENO, "PIPE"); break;
+        case NODE_AND: output_puts(STDOUT_FILENO, "AND"); break;
+        case NODE_OR: output_puts(STDOUT_FILENO, "OR"); break;
+        case NODE_SEQUENCE: output_puts(STDOUT_FILENO, "SEQUENCE"); break;
+        case NODE_BACKGROUND: output_puts(STDOUT_FILENO, "BACKGROUND"); break;
+        case NODE_SUBSHELL: output_puts(STDOUT_FILENO, "SUBSHELL"); break;
+        case NODE_GROUP: output_puts(STDOUT_FILENO, "GROUP"); break;
+        case NODE_IF: output_puts(STDOUT_FILENO, "IF"); break;
+        case NODE_WHILE: output_puts(STDOUT_FILENO, "WHILE"); break;
+        case NODE_UNTIL: output_puts(STDOUT_FILENO, "UNTIL"); break;
+        case NODE_FOR:
+            output_printf(STDOUT_FILENO, "FOR %s", node->name);
+            if (node->args) output_puts(STDOUT_FILENO, " in");
+            for (int i = 0; node->args && node->args[i]; ++i) output_printf(STDOUT_FILENO, " %s", node->args[i]);
+            break;
+        case NODE_FUNCTION: output_printf(STDOUT_FILENO, "FUNCTION %s", node->name); break;
+        case NODE_TIME: output_puts(STDOUT_FILENO, "TIME"); break;
+        case NODE_GUARD:
+            output_puts(STDOUT_FILENO, "GUARD");
+            for (int i = 0; node->args[i]; ++i) output_printf(STDOUT_FILENO, " %s", node->args[i]);
             break;
-        case NODE_PIPE: printf("PIPE"); break;
-        case NODE_AND: printf("AND"); break;
-        case NODE_OR: printf("OR"); break;
-        case NODE_SEQUENCE: printf("SEQUENCE"); break;
-        case NODE_BACKGROUND: printf("BACKGROUND"); break;
-        case NODE_SUBSHELL: printf("SUBSHELL"); break;
     }
-    printf("\n");
+    if (node->type != NODE_COMMAND) print_redirections(node);
+    output_puts(STDOUT_FILENO, "\n");
 
     if (node->left && node->left != node) print_ast(node->left, level + 1);
     if (node->right && node->right != node) print_ast(node->right, level + 1);
+    for (int i = 0; i < node->child_count; ++i) print_ast(node->children[i], level + 1);
 }
 
 void test_parser(const char *input) {
-    printf("Parsing \"%s\"\n", input);
-    TokenArray *tokens = tokenize(input);
+    Arena arena;
+    arena_init(&arena);
+
+    output_printf(STDOUT_FILENO, "Parsing \"%s\"\n", input);
+    TokenArray *tokens = tokenize(&arena, input);
     ASTNode *ast = parse_expression(tokens);
     print_ast(ast, 0);
-    free_ast(ast);
-    free_token_array(tokens);
-    printf("\n");
+    output_puts(STDOUT_FILENO, "\n");
+
+    arena_free(&arena);
 }
\ No newline at end of file
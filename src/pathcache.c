@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "pathcache.h"
+#include "variables.h"
+#include "output.h"
+
+static PathEntry **buckets = NULL;
+static int bucket_count = 0;
+static int entry_count = 0;
+static char *cached_path_env = NULL;
+
+static unsigned long hash_name(const char *name) {
+    unsigned long hash = 5381;
+    for (const unsigned char *p = (const unsigned char *)name; *p; ++p) {
+        hash = hash * 33 + *p;
+    }
+    return hash;
+}
+
+static void path_cache_grow(void) {
+    int new_count = bucket_count ? bucket_count * 2 : PATH_CACHE_INITIAL_BUCKETS;
+    PathEntry **new_buckets = calloc(new_count, sizeof(PathEntry *));
+
+    for (int i = 0; i < bucket_count; ++i) {
+        PathEntry *entry = buckets[i];
+        while (entry) {
+            PathEntry *next = entry->next;
+            int index = entry->hash & (new_count - 1);
+            entry->next = new_buckets[index];
+            new_buckets[index] = entry;
+            entry = next;
+        }
+    }
+
+    free(buckets);
+    buckets = new_buckets;
+    bucket_count = new_count;
+}
+
+void path_cache_clear(void) {
+    for (int i = 0; i < bucket_count; ++i) {
+        PathEntry *entry = buckets[i];
+        while (entry) {
+            PathEntry *next = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+            entry = next;
+        }
+        buckets[i] = NULL;
+    }
+    entry_count = 0;
+}
+
+/* The cache is only valid for the PATH it was filled from; assigning PATH
+ * calls path_cache_invalidate. */
+static void path_cache_validate(void) {
+    if (cached_path_env) return;
+
+    const char *path_env = var_get("PATH");
+    cached_path_env = strdup(path_env ? path_env : "");
+}
+
+void path_cache_invalidate(void) {
+    path_cache_clear();
+    free(cached_path_env);
+    cached_path_env = NULL;
+}
+
+static char *path_search(const char *name) {
+    const char *dir = cached_path_env;
+    size_t name_length = strlen(name);
+
+    while (1) {
+        const char *end = strchr(dir, ':');
+        size_t dir_length = end ? (size_t)(end - dir) : strlen(dir);
+
+        char *candidate = malloc(dir_length + name_length + 3);
+        if (dir_length) {
+            memcpy(candidate, dir, dir_length);
+        }
+        else {
+            candidate[0] = '.';
+            dir_length = 1;
+        }
+        candidate[dir_length] = '/';
+        memcpy(candidate + dir_length + 1, name, name_length + 1);
+
+        struct stat st;
+        if (!stat(candidate, &st) && S_ISREG(st.st_mode) && !access(candidate, X_OK)) {
+            return candidate;
+        }
+        free(candidate);
+
+        if (!end) return NULL;
+        dir = end + 1;
+    }
+}
+
+const char *path_lookup(const char *name) {
+    path_cache_validate();
+
+    unsigned long hash = hash_name(name);
+    if (bucket_count) {
+        for (PathEntry *entry = buckets[hash & (bucket_count - 1)]; entry; entry = entry->next) {
+            if (entry->hash == hash && !strcmp(entry->name, name)) {
+                entry->hits++;
+                return entry->path;
+            }
+        }
+    }
+
+    char *path = path_search(name);
+    if (!path) return NULL;
+
+    if (entry_count + 1 > bucket_count * 3 / 4) path_cache_grow();
+
+    PathEntry *entry = malloc(sizeof(PathEntry));
+    entry->hash = hash;
+    entry->name = strdup(name);
+    entry->path = path;
+    entry->hits = 1;
+
+    int index = hash & (bucket_count - 1);
+    entry->next = buckets[index];
+    buckets[index] = entry;
+    entry_count++;
+    return entry->path;
+}
+
+void path_cache_forget(const char *name) {
+    if (!bucket_count) return;
+
+    unsigned long hash = hash_name(name);
+    PathEntry **link = &buckets[hash & (bucket_count - 1)];
+    while (*link) {
+        PathEntry *entry = *link;
+        if (entry->hash == hash && !strcmp(entry->name, name)) {
+            *link = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+            entry_count--;
+            return;
+        }
+        link = &entry->next;
+    }
+}
+
+void path_cache_print(void) {
+    path_cache_validate();
+
+    if (!entry_count) {
+        output_printf(STDOUT_FILENO, "hash: hash table empty\n");
+        return;
+    }
+
+    output_printf(STDOUT_FILENO, "hits\tcommand\n");
+    for (int i = 0; i < bucket_count; ++i) {
+        for (PathEntry *entry = buckets[i]; entry; entry = entry->next) {
+            output_printf(STDOUT_FILENO, "%4d\t%s\n", entry->hits, entry->path);
+        }
+    }
+}
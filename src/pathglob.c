@@ -0,0 +1,461 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "pathglob.h"
+
+enum {
+    GLOB_CHAR,
+    GLOB_ANY,
+    GLOB_STAR,
+    GLOB_CLASS
+};
+
+typedef struct {
+    unsigned char type;
+    unsigned char ch;
+    uint16_t class;
+} GlobOp;
+
+/* One '/'-separated piece of a pattern, compiled once per expansion. A
+ * component without '*', '?' or '[...]' is just literal, the name to look
+ * up; otherwise prefix counts the leading GLOB_CHAR ops, which select a
+ * range of the sorted listing by binary search. */
+typedef struct {
+    GlobOp *ops;
+    int count;
+    uint64_t (*classes)[4];
+    char *literal;
+    int prefix;
+    bool magic;
+    bool globstar;
+    bool dot;
+} GlobComponent;
+
+typedef struct {
+    Arena *arena;
+    GlobComponent *components;
+    int count;
+    bool trailing_slash;
+    char *path;
+    size_t capacity;
+    char **matches;
+    int match_count;
+    int match_capacity;
+} Glob;
+
+struct linux_dirent64 {
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+static DirListing *cache[GLOB_CACHE_SLOTS];
+static size_t cache_bytes = 0;
+static unsigned long cache_tick = 0;
+
+/* Bottom-up merge sort: stable, unlike qsort. */
+static void merge_sort(void *base, size_t count, size_t size,
+        int (*compare)(const void *, const void *, const void *), const void *context) {
+    char *from = base;
+    char *to = malloc(count * size);
+    char *buffer = to;
+
+    for (size_t width = 1; width < count; width *= 2) {
+        for (size_t start = 0; start < count; start += 2 * width) {
+            size_t middle = start + width < count ? start + width : count;
+            size_t end = start + 2 * width < count ? start + 2 * width : count;
+            size_t i = start, j = middle, k = start;
+            while (i < middle && j < end) {
+                if (compare(from + j * size, from + i * size, context) < 0) memcpy(to + k++ * size, from + j++ * size, size);
+                else memcpy(to + k++ * size, from + i++ * size, size);
+            }
+            memcpy(to + k * size, from + i * size, (middle - i) * size);
+            k += middle - i;
+            memcpy(to + k * size, from + j * size, (end - j) * size);
+        }
+        char *swap = from;
+        from = to;
+        to = swap;
+    }
+    if (from != base) memcpy(base, from, count * size);
+    free(buffer);
+}
+
+static int compare_entries(const void *a, const void *b, const void *names) {
+    return strcmp((const char *)names + ((const GlobEntry *)a)->name,
+            (const char *)names + ((const GlobEntry *)b)->name);
+}
+
+static int compare_matches(const void *a, const void *b, const void *context) {
+    (void)context;
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void listing_free(DirListing *listing) {
+    free(listing->names);
+    free(listing->entries);
+    free(listing);
+}
+
+static void listing_release(DirListing *listing) {
+    if (--listing->pinned == 0 && !listing->cached) listing_free(listing);
+}
+
+static void cache_remove(int slot) {
+    DirListing *listing = cache[slot];
+    cache[slot] = NULL;
+    cache_bytes -= listing->bytes;
+    listing->cached = false;
+    if (!listing->pinned) listing_free(listing);
+}
+
+/* Keeps listing if the budget allows, evicting the least recently used
+ * listings that are not being walked. */
+static void cache_insert(DirListing *listing) {
+    if (listing->bytes > GLOB_CACHE_BUDGET) return;
+
+    while (1) {
+        int free_slot = -1;
+        int oldest = -1;
+        for (int i = 0; i < GLOB_CACHE_SLOTS; ++i) {
+            if (!cache[i]) free_slot = i;
+            else if (!cache[i]->pinned && (oldest < 0 || cache[i]->used < cache[oldest]->used)) oldest = i;
+        }
+        if (free_slot >= 0 && cache_bytes + listing->bytes <= GLOB_CACHE_BUDGET) {
+            cache[free_slot] = listing;
+            cache_bytes += listing->bytes;
+            listing->cached = true;
+            return;
+        }
+        if (oldest < 0) return;
+        cache_remove(oldest);
+    }
+}
+
+static bool same_time(const struct timespec *a, const struct timespec *b) {
+    return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+static DirListing *listing_read(const char *dir) {
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st)) {
+        close(fd);
+        return NULL;
+    }
+
+    DirListing *listing = calloc(1, sizeof(DirListing));
+    listing->dev = st.st_dev;
+    listing->ino = st.st_ino;
+    listing->mtime = st.st_mtim;
+    listing->ctime = st.st_ctim;
+
+    size_t names_length = 0, names_capacity = 4096;
+    int entries_capacity = 64;
+    listing->names = malloc(names_capacity);
+    listing->entries = malloc(entries_capacity * sizeof(GlobEntry));
+
+    char *buffer = malloc(GLOB_READ_BUFFER);
+    long n;
+    while ((n = syscall(SYS_getdents64, fd, buffer, GLOB_READ_BUFFER)) > 0) {
+        for (long offset = 0; offset < n;) {
+            struct linux_dirent64 *entry = (struct linux_dirent64 *)(buffer + offset);
+            offset += entry->d_reclen;
+
+            const char *name = entry->d_name;
+            if (name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2]))) continue;
+
+            size_t length = strlen(name) + 1;
+            if (names_length + length > names_capacity) {
+                while (names_length + length > names_capacity) names_capacity *= 2;
+                listing->names = realloc(listing->names, names_capacity);
+            }
+            if (listing->count == entries_capacity) {
+                entries_capacity *= 2;
+                listing->entries = realloc(listing->entries, entries_capacity * sizeof(GlobEntry));
+            }
+            memcpy(listing->names + names_length, name, length);
+            listing->entries[listing->count].name = names_length;
+            listing->entries[listing->count++].type = entry->d_type;
+            names_length += length;
+        }
+    }
+    free(buffer);
+    close(fd);
+
+    merge_sort(listing->entries, listing->count, sizeof(GlobEntry), compare_entries, listing->names);
+    listing->bytes = sizeof(DirListing) + names_capacity + entries_capacity * sizeof(GlobEntry);
+    return listing;
+}
+
+/* Returns the listing of dir, pinned until listing_release. */
+static DirListing *listing_get(const char *dir) {
+    struct stat st;
+    if (stat(dir, &st) || !S_ISDIR(st.st_mode)) return NULL;
+
+    for (int i = 0; i < GLOB_CACHE_SLOTS; ++i) {
+        DirListing *listing = cache[i];
+        if (!listing || listing->dev != st.st_dev || listing->ino != st.st_ino) continue;
+        if (same_time(&listing->mtime, &st.st_mtim) && same_time(&listing->ctime, &st.st_ctim)) {
+            listing->used = ++cache_tick;
+            listing->pinned++;
+            return listing;
+        }
+        cache_remove(i);
+        break;
+    }
+
+    DirListing *listing = listing_read(dir);
+    if (!listing) return NULL;
+    listing->used = ++cache_tick;
+    listing->pinned = 1;
+    cache_insert(listing);
+    return listing;
+}
+
+/* Parses a bracket expression starting after '['. Returns the position
+ * after ']', or NULL if there is none and '[' is an ordinary character. */
+static const char *compile_class(const char *p, const char *end, uint64_t bits[4]) {
+    bool negate = p < end && (*p == '!' || *p == '^');
+    if (negate) p++;
+    memset(bits, 0, 4 * sizeof(uint64_t));
+
+    bool first = true;
+    while (p < end && (*p != ']' || first)) {
+        first = false;
+        unsigned char low = *p == '\\' && p + 1 < end ? *++p : *p;
+        unsigned char high = low;
+        p++;
+        if (p + 1 < end && *p == '-' && p[1] != ']') {
+            p++;
+            high = *p == '\\' && p + 1 < end ? *++p : *p;
+            p++;
+        }
+        for (unsigned c = low; c <= high; ++c) bits[c >> 6] |= 1ULL << (c & 63);
+    }
+    if (p >= end) return NULL;
+
+    if (negate) {
+        for (int i = 0; i < 4; ++i) bits[i] = ~bits[i];
+    }
+    bits[0] &= ~1ULL;
+    bits['/' >> 6] &= ~(1ULL << ('/' & 63));
+    return p + 1;
+}
+
+static void compile_component(Arena *arena, GlobComponent *component, const char *text, size_t length) {
+    const char *end = text + length;
+    component->ops = arena_alloc(arena, length * sizeof(GlobOp));
+    component->classes = arena_alloc(arena, length * sizeof(*component->classes));
+    component->literal = arena_alloc(arena, length + 1);
+    component->globstar = length == 2 && text[0] == '*' && text[1] == '*';
+
+    int classes = 0;
+    size_t literal = 0;
+    bool in_prefix = true;
+    for (const char *p = text; p < end;) {
+        GlobOp *op = &component->ops[component->count++];
+        const char *next;
+        if (*p == '*') {
+            op->type = GLOB_STAR;
+            while (p < end && *p == '*') p++;
+        }
+        else if (*p == '?') {
+            op->type = GLOB_ANY;
+            p++;
+        }
+        else if (*p == '[' && (next = compile_class(p + 1, end, component->classes[classes]))) {
+            op->type = GLOB_CLASS;
+            op->class = classes++;
+            p = next;
+        }
+        else {
+            if (*p == '\\' && p + 1 < end) p++;
+            op->type = GLOB_CHAR;
+            op->ch = *p++;
+            if (in_prefix) component->literal[literal++] = op->ch;
+            if (in_prefix) component->prefix++;
+            continue;
+        }
+        component->magic = true;
+        in_prefix = false;
+    }
+    component->literal[literal] = '\0';
+    component->dot = component->count && component->ops[0].type == GLOB_CHAR && component->ops[0].ch == '.';
+}
+
+static bool op_matches(const GlobComponent *component, const GlobOp *op, unsigned char c) {
+    switch (op->type) {
+        case GLOB_CHAR: return c == op->ch;
+        case GLOB_ANY: return true;
+        case GLOB_CLASS: return component->classes[op->class][c >> 6] & (1ULL << (c & 63));
+    }
+    return false;
+}
+
+/* Matches name against the ops after the literal prefix, which the caller
+ * has already checked. A failed match backtracks to the last '*' only. */
+static bool component_match(const GlobComponent *component, const char *name) {
+    int op = component->prefix;
+    int star_op = -1;
+    const char *star_name = NULL;
+
+    while (*name) {
+        if (op < component->count) {
+            const GlobOp *current = &component->ops[op];
+            if (current->type == GLOB_STAR) {
+                star_op = ++op;
+                star_name = name;
+                continue;
+            }
+            if (op_matches(component, current, *name)) {
+                op++;
+                name++;
+                continue;
+            }
+        }
+        if (star_op < 0) return false;
+        op = star_op;
+        name = ++star_name;
+    }
+    while (op < component->count && component->ops[op].type == GLOB_STAR) op++;
+    return op == component->count;
+}
+
+static size_t path_append(Glob *glob, size_t length, const char *name) {
+    size_t name_length = strlen(name);
+    bool slash = length && glob->path[length - 1] != '/';
+    if (length + name_length + 2 > glob->capacity) {
+        while (length + name_length + 2 > glob->capacity) glob->capacity *= 2;
+        glob->path = realloc(glob->path, glob->capacity);
+    }
+    if (slash) glob->path[length++] = '/';
+    memcpy(glob->path + length, name, name_length + 1);
+    return length + name_length;
+}
+
+static bool is_directory(Glob *glob, unsigned char type, bool follow) {
+    if (type == DT_DIR) return true;
+    if (type != DT_UNKNOWN && !(follow && type == DT_LNK)) return false;
+    struct stat st;
+    return !(follow ? stat : lstat)(glob->path, &st) && S_ISDIR(st.st_mode);
+}
+
+static void add_match(Glob *glob, size_t length, unsigned char type) {
+    if (glob->trailing_slash) {
+        if (!is_directory(glob, type, true)) return;
+        length = path_append(glob, length, "");
+    }
+    if (glob->match_count == glob->match_capacity) {
+        glob->match_capacity = glob->match_capacity ? glob->match_capacity * 2 : 16;
+        glob->matches = realloc(glob->matches, glob->match_capacity * sizeof(char *));
+    }
+    glob->matches[glob->match_count++] = arena_strndup(glob->arena, glob->path, length);
+}
+
+/* First entry whose name starts with prefix, if any; the ones after it
+ * that share the prefix follow it in the sorted listing. */
+static int prefix_start(DirListing *listing, const char *prefix, size_t length) {
+    int low = 0, high = listing->count;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (strncmp(listing->names + listing->entries[middle].name, prefix, length) < 0) low = middle + 1;
+        else high = middle;
+    }
+    return low;
+}
+
+static void glob_walk(Glob *glob, size_t length, int index) {
+    GlobComponent *component = &glob->components[index];
+    bool last = index + 1 == glob->count;
+
+    if (!component->magic) {
+        size_t next = path_append(glob, length, component->literal);
+        struct stat st;
+        if (!last) glob_walk(glob, next, index + 1);
+        else if (!lstat(glob->path, &st)) add_match(glob, next, S_ISDIR(st.st_mode) ? DT_DIR : DT_UNKNOWN);
+        return;
+    }
+
+    glob->path[length] = '\0';
+    DirListing *listing = listing_get(length ? glob->path : ".");
+    if (!listing) return;
+
+    if (component->globstar) {
+        if (!last) glob_walk(glob, length, index + 1);
+        for (int i = 0; i < listing->count; ++i) {
+            const char *name = listing->names + listing->entries[i].name;
+            if (name[0] == '.') continue;
+            size_t next = path_append(glob, length, name);
+            if (last) add_match(glob, next, listing->entries[i].type);
+            if (is_directory(glob, listing->entries[i].type, false)) glob_walk(glob, next, index);
+        }
+    }
+    else {
+        size_t prefix = component->prefix;
+        for (int i = prefix_start(listing, component->literal, prefix); i < listing->count; ++i) {
+            const char *name = listing->names + listing->entries[i].name;
+            if (strncmp(name, component->literal, prefix)) break;
+            if ((name[0] == '.' && !component->dot) || !component_match(component, name + prefix)) continue;
+
+            unsigned char type = listing->entries[i].type;
+            size_t next = path_append(glob, length, name);
+            if (last) add_match(glob, next, type);
+            else if (type == DT_DIR || type == DT_LNK || type == DT_UNKNOWN) glob_walk(glob, next, index + 1);
+        }
+    }
+    listing_release(listing);
+}
+
+int path_glob(Arena *arena, const char *pattern, char ***matches) {
+    Glob glob;
+    memset(&glob, 0, sizeof(glob));
+    glob.arena = arena;
+
+    int count = 1;
+    for (const char *p = pattern; *p; ++p) count += *p == '/';
+    glob.components = arena_alloc(arena, count * sizeof(GlobComponent));
+    memset(glob.components, 0, count * sizeof(GlobComponent));
+
+    bool magic = false;
+    const char *p = pattern;
+    while (*p) {
+        const char *end = strchr(p, '/');
+        if (!end) end = p + strlen(p);
+        if (end > p) {
+            GlobComponent *component = &glob.components[glob.count++];
+            compile_component(arena, component, p, end - p);
+            magic |= component->magic;
+        }
+        if (!*end) break;
+        glob.trailing_slash = !end[1];
+        p = end + 1;
+    }
+    if (!magic || !glob.count) return 0;
+
+    glob.capacity = 256;
+    glob.path = malloc(glob.capacity);
+    size_t length = 0;
+    if (pattern[0] == '/') glob.path[length++] = '/';
+    glob.path[length] = '\0';
+    glob_walk(&glob, length, 0);
+    free(glob.path);
+
+    if (glob.match_count) {
+        merge_sort(glob.matches, glob.match_count, sizeof(char *), compare_matches, NULL);
+        *matches = arena_alloc(arena, glob.match_count * sizeof(char *));
+        memcpy(*matches, glob.matches, glob.match_count * sizeof(char *));
+    }
+    free(glob.matches);
+    return glob.match_count;
+}
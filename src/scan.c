@@ -0,0 +1,212 @@
+#include <stddef.h>
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+#define S SCAN_SPACE
+#define O SCAN_OPERATOR
+#define Q SCAN_QUOTE
+#define E SCAN_EXPAND
+#define G SCAN_GLOB
+
+const unsigned char scan_class[256] = {
+    ['\t'] = S, ['\v'] = S, ['\f'] = S, ['\r'] = S, [' '] = S,
+    ['\n'] = O, ['|'] = O, ['&'] = O, [';'] = O, ['<'] = O, ['>'] = O, ['('] = O, [')'] = O,
+    ['"'] = Q, ['\''] = Q, ['\\'] = Q,
+    ['$'] = E, ['`'] = E,
+    ['*'] = G, ['?'] = G, ['['] = G
+};
+
+#undef S
+#undef O
+#undef Q
+#undef E
+#undef G
+
+static int word_end_scalar(const char *input, int position, int length) {
+    while (position < length && !(scan_class[(unsigned char)input[position]] & SCAN_WORD_END)) position++;
+    return position;
+}
+
+static int skip_space_scalar(const char *input, int position, int length) {
+    while (position < length && (scan_class[(unsigned char)input[position]] & SCAN_SPACE)) position++;
+    return position;
+}
+
+#ifdef SCAN_X86
+
+/* Candidates are every byte <= ' ' plus the operator, quote and expansion
+ * characters; control bytes that are not whitespace are filtered through
+ * scan_class. */
+static inline unsigned sse2_delimiters(__m128i v) {
+    __m128i mask = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(' ')), v);
+    mask = _mm_or_si128(mask, _mm_cmpeq_epi8(v, _mm_set1_epi8('|')));
+    mask = _mm_or_si128(mask, _mm_cmpeq_epi8(v, _mm_set1_epi8('&')));
+    mask = _mm_or_si128(mask, _mm_cmpeq_epi8(v, _mm_set1_epi8(';')));
+    mask = _mm_or_si128(mask, _mm_cmpeq_epi8(v, _mm_set1_epi8('<')));
+    mask = _mm_or_si128(mask, _mm_cmpeq_epi8(v, _mm_set1_epi8('>')));
+    mask = _mm_or_si128(mask, _mm_cmpeq_epi8(v, _mm_set1_epi8('(')));
+    mask = _mm_or_si128(mask, _mm_cmpeq_epi8(v, _mm_set1_epi8(')')));
+    mask = _mm_or_si128(mask, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+    mask = _mm_or_si128(mask, _mm_cmpeq_epi8(v, _mm_set1_epi8('\'')));
+    mask = _mm_or_si128(mask, _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+    mask = _mm_or_si128(mask, _mm_cmpeq_epi8(v, _mm_set1_epi8('$')));
+    mask = _mm_or_si128(mask, _mm_cmpeq_epi8(v, _mm_set1_epi8('`')));
+    return (unsigned)_mm_movemask_epi8(mask);
+}
+
+/* Newline separates commands, so it is not skipped as space. */
+static inline unsigned sse2_spaces(__m128i v) {
+    __m128i mask = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+    __m128i shifted = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+    __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8('\r' - '\t')), shifted);
+    control = _mm_andnot_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), control);
+    return (unsigned)_mm_movemask_epi8(_mm_or_si128(mask, control));
+}
+
+static int word_end_sse2(const char *input, int position, int length) {
+    while (position + 16 <= length) {
+        unsigned bits = sse2_delimiters(_mm_loadu_si128((const __m128i *)(input + position)));
+        while (bits) {
+            int index = __builtin_ctz(bits);
+            if (scan_class[(unsigned char)input[position + index]] & SCAN_WORD_END) return position + index;
+            bits &= bits - 1;
+        }
+        position += 16;
+    }
+    return word_end_scalar(input, position, length);
+}
+
+static int skip_space_sse2(const char *input, int position, int length) {
+    while (position + 16 <= length) {
+        unsigned bits = ~sse2_spaces(_mm_loadu_si128((const __m128i *)(input + position))) & 0xffff;
+        if (bits) return position + __builtin_ctz(bits);
+        position += 16;
+    }
+    return skip_space_scalar(input, position, length);
+}
+
+__attribute__((target("avx2")))
+static inline unsigned avx2_delimiters(__m256i v) {
+    __m256i mask = _mm256_cmpeq_epi8(_mm256_min_epu8(v, _mm256_set1_epi8(' ')), v);
+    mask = _mm256_or_si256(mask, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('|')));
+    mask = _mm256_or_si256(mask, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('&')));
+    mask = _mm256_or_si256(mask, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(';')));
+    mask = _mm256_or_si256(mask, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('<')));
+    mask = _mm256_or_si256(mask, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('>')));
+    mask = _mm256_or_si256(mask, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('(')));
+    mask = _mm256_or_si256(mask, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(')')));
+    mask = _mm256_or_si256(mask, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')));
+    mask = _mm256_or_si256(mask, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\'')));
+    mask = _mm256_or_si256(mask, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+    mask = _mm256_or_si256(mask, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('$')));
+    mask = _mm256_or_si256(mask, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('`')));
+    return (unsigned)_mm256_movemask_epi8(mask);
+}
+
+__attribute__((target("avx2")))
+static inline unsigned avx2_spaces(__m256i v) {
+    __m256i mask = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+    __m256i shifted = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+    __m256i control = _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8('\r' - '\t')), shifted);
+    control = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')), control);
+    return (unsigned)_mm256_movemask_epi8(_mm256_or_si256(mask, control));
+}
+
+__attribute__((target("avx2")))
+static int word_end_avx2(const char *input, int position, int length) {
+    while (position + 32 <= length) {
+        unsigned bits = avx2_delimiters(_mm256_loadu_si256((const __m256i *)(input + position)));
+        while (bits) {
+            int index = __builtin_ctz(bits);
+            if (scan_class[(unsigned char)input[position + index]] & SCAN_WORD_END) return position + index;
+            bits &= bits - 1;
+        }
+        position += 32;
+    }
+    return word_end_sse2(input, position, length);
+}
+
+__attribute__((target("avx2")))
+static int skip_space_avx2(const char *input, int position, int length) {
+    while (position + 32 <= length) {
+        unsigned bits = ~avx2_spaces(_mm256_loadu_si256((const __m256i *)(input + position)));
+        if (bits) return position + __builtin_ctz(bits);
+        position += 32;
+    }
+    return skip_space_sse2(input, position, length);
+}
+
+#endif
+
+static int word_end_init(const char *input, int position, int length);
+static int skip_space_init(const char *input, int position, int length);
+
+static int (*word_end_impl)(const char *, int, int) = word_end_init;
+static int (*skip_space_impl)(const char *, int, int) = skip_space_init;
+
+static int word_end_init(const char *input, int position, int length) {
+    scan_select(scan_best());
+    return word_end_impl(input, position, length);
+}
+
+static int skip_space_init(const char *input, int position, int length) {
+    scan_select(scan_best());
+    return skip_space_impl(input, position, length);
+}
+
+int scan_word_end(const char *input, int position, int length) {
+    return word_end_impl(input, position, length);
+}
+
+int scan_skip_space(const char *input, int position, int length) {
+    /* Separators are usually a single blank, so look at the first byte before
+     * paying for a vector load. */
+    if (position < length && !(scan_class[(unsigned char)input[position]] & SCAN_SPACE)) return position;
+    return skip_space_impl(input, position, length);
+}
+
+ScanImpl scan_best(void) {
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return SCAN_AVX2;
+    return SCAN_SSE2;
+#else
+    return SCAN_SCALAR;
+#endif
+}
+
+int scan_select(ScanImpl impl) {
+    switch (impl) {
+        case SCAN_SCALAR:
+            word_end_impl = word_end_scalar;
+            skip_space_impl = skip_space_scalar;
+            return 0;
+#ifdef SCAN_X86
+        case SCAN_SSE2:
+            word_end_impl = word_end_sse2;
+            skip_space_impl = skip_space_sse2;
+            return 0;
+        case SCAN_AVX2:
+            __builtin_cpu_init();
+            if (!__builtin_cpu_supports("avx2")) return -1;
+            word_end_impl = word_end_avx2;
+            skip_space_impl = skip_space_avx2;
+            return 0;
+#endif
+        default:
+            return -1;
+    }
+}
+
+const char *scan_impl_name(ScanImpl impl) {
+    switch (impl) {
+        case SCAN_SCALAR: return "scalar";
+        case SCAN_SSE2: return "sse2";
+        case SCAN_AVX2: return "avx2";
+    }
+    return "unknown";
+}
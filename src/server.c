@@ -0,0 +1,366 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "server.h"
+#include "executor.h"
+#include "input.h"
+#include "timing.h"
+#include "variables.h"
+
+static volatile sig_atomic_t server_stopping = 0;
+
+/* The connection a worker answers when it exits, however the command
+ * ends. */
+static int request_fd = -1;
+static struct timespec request_start;
+
+static double timeval_ms(struct timeval tv) {
+    return tv.tv_sec * 1e3 + tv.tv_usec / 1e3;
+}
+
+static int open_socket(const char *path, struct sockaddr_un *address) {
+    if (strlen(path) >= sizeof(address->sun_path)) {
+        fprintf(stderr, "%s: socket path too long\n", path);
+        return -1;
+    }
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    strcpy(address->sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) perror("socket failed");
+    return fd;
+}
+
+/* A worker is a single process, so its own usage and that of its reaped
+ * children are exactly the request's. */
+static void send_reply(void) {
+    if (request_fd < 0) return;
+    fflush(NULL);
+
+    struct timespec end;
+    struct rusage self, children;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &children);
+
+    double wall = (end.tv_sec - request_start.tv_sec) * 1e3 + (end.tv_nsec - request_start.tv_nsec) / 1e6;
+    dprintf(request_fd, "status=%d wall_ms=%.3f user_ms=%.3f sys_ms=%.3f maxrss_kb=%ld nvcsw=%ld nivcsw=%ld\n",
+            shell_last_status, wall, timeval_ms(self.ru_utime) + timeval_ms(children.ru_utime),
+            timeval_ms(self.ru_stime) + timeval_ms(children.ru_stime),
+            self.ru_maxrss > children.ru_maxrss ? self.ru_maxrss : children.ru_maxrss,
+            self.ru_nvcsw + children.ru_nvcsw, self.ru_nivcsw + children.ru_nivcsw);
+    close(request_fd);
+    request_fd = -1;
+}
+
+/* Reads the payload up to the client's shutdown and the three descriptors
+ * sent along with its first bytes. */
+static char *read_request(int fd, int fds[3], size_t *length) {
+    size_t capacity = 4096;
+    char *data = malloc(capacity);
+    *length = 0;
+
+    while (1) {
+        if (*length + 1 == capacity) {
+            capacity *= 2;
+            data = realloc(data, capacity);
+        }
+        struct iovec iov = { data + *length, capacity - *length - 1 };
+        union {
+            struct cmsghdr header;
+            char space[CMSG_SPACE(3 * sizeof(int))];
+        } control;
+        struct msghdr message = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = &control,
+                .msg_controllen = sizeof(control) };
+
+        ssize_t n = recvmsg(fd, &message, MSG_CMSG_CLOEXEC);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            free(data);
+            return NULL;
+        }
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+                    cmsg->cmsg_len == CMSG_LEN(3 * sizeof(int))) {
+                memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+            }
+        }
+        /* Descriptors that did not fit were dropped by the kernel. */
+        if (message.msg_flags & MSG_CTRUNC) {
+            fprintf(stderr, "server: request carried too many descriptors\n");
+            free(data);
+            return NULL;
+        }
+        if (n == 0) break;
+        *length += n;
+    }
+    data[*length] = '\0';
+    return data;
+}
+
+/* Whether an applied request holds an E record for name, whose '=' has
+ * become the end of the name. */
+static bool is_listed(const char *data, size_t length, const char *name, size_t name_length) {
+    for (size_t i = 0; i < length; i += strlen(data + i) + 1) {
+        const char *record = data + i;
+        if (record[0] == 'E' && !strncmp(record + 1, name, name_length) && !record[name_length + 1]) return true;
+    }
+    return false;
+}
+
+/* Exported variables the client did not send are the server's own, and
+ * would not exist in a shell started by the client. */
+static void drop_unlisted(const char *data, size_t length) {
+    char **env = var_environ();
+    int count = 0;
+    while (env[count]) count++;
+
+    char **names = malloc((count + 1) * sizeof(char *));
+    int dropped = 0;
+    for (int i = 0; i < count; ++i) {
+        size_t name_length = strcspn(env[i], "=");
+        if (!is_listed(data, length, env[i], name_length)) names[dropped++] = strndup(env[i], name_length);
+    }
+    for (int i = 0; i < dropped; ++i) {
+        var_unset(names[i]);
+        free(names[i]);
+    }
+    free(names);
+}
+
+/* The client's environment is applied over the worker's; only values that
+ * differ are set, so PATH and its lookup cache survive when unchanged. */
+static const char *apply_request(char *data, size_t length) {
+    const char *command = NULL;
+
+    for (size_t i = 0; i < length; i += strlen(data + i) + 1) {
+        char *record = data + i;
+        switch (record[0]) {
+            case 'C':
+                if (chdir(record + 1)) perror(record + 1);
+                break;
+            case 'E': {
+                char *eq = strchr(record + 1, '=');
+                if (!eq || eq == record + 1) break;
+                *eq = '\0';
+                const char *old = var_get(record + 1);
+                if (!old || strcmp(old, eq + 1) || !var_is_exported(record + 1)) var_set(record + 1, eq + 1, true);
+                break;
+            }
+            case 'X':
+                command = record + 1;
+                break;
+        }
+    }
+    drop_unlisted(data, length);
+    return command;
+}
+
+/* Serves one request and exits; the master forks a fresh worker in its
+ * place, so no state leaks from one request into the next. */
+static void worker_run(int listen_fd) {
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+
+    int fd;
+    while ((fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC)) < 0) {
+        if (errno != EINTR) {
+            perror("accept failed");
+            _exit(1);
+        }
+    }
+    close(listen_fd);
+    clock_gettime(CLOCK_MONOTONIC, &request_start);
+    request_fd = fd;
+    atexit(send_reply);
+
+    int fds[3] = { -1, -1, -1 };
+    size_t length;
+    char *data = read_request(fd, fds, &length);
+    if (!data || fds[0] < 0) {
+        fprintf(stderr, "server: malformed request\n");
+        execute_exit(2);
+    }
+    for (int i = 0; i < 3; ++i) {
+        dup2(fds[i], i);
+        close(fds[i]);
+    }
+
+    const char *command = apply_request(data, length);
+    Input input;
+    input_open_string(&input, command ? command : "");
+    execute_exit(shell_loop(&input));
+}
+
+static pid_t start_worker(int listen_fd) {
+    pid_t pid = fork();
+    if (pid < 0) perror("fork failed");
+    if (!pid) worker_run(listen_fd);
+    return pid;
+}
+
+/* Work that every worker would otherwise repeat after its fork: picking
+ * the scanner and faulting in the lexer and parser. */
+static void warm_up(void) {
+    Arena arena;
+    arena_init(&arena);
+    parse_expression(tokenize(&arena, "true 'a' \"b\" | true > /dev/null && true; true &"));
+    arena_free(&arena);
+}
+
+static void stop_handler(int sig) {
+    (void)sig;
+    server_stopping = 1;
+}
+
+/* Listens on path with a pool of pre-forked workers and replaces each
+ * one as soon as it exits. SIGINT or SIGTERM stops the pool and removes
+ * the socket. */
+int server_run(const char *path, int workers) {
+    struct sockaddr_un address;
+    int listen_fd = open_socket(path, &address);
+    if (listen_fd < 0) return 1;
+    if (workers < 1) workers = SERVER_DEFAULT_WORKERS;
+
+    struct stat st;
+    if (!lstat(path, &st) && S_ISSOCK(st.st_mode)) unlink(path);
+    if (bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) || listen(listen_fd, SERVER_BACKLOG)) {
+        perror(path);
+        close(listen_fd);
+        return 1;
+    }
+    warm_up();
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_handler;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    pid_t *pool = calloc(workers, sizeof(pid_t));
+    while (!server_stopping) {
+        for (int i = 0; i < workers; ++i) {
+            if (pool[i] <= 0) pool[i] = start_worker(listen_fd);
+        }
+
+        pid_t pid = waitpid(-1, NULL, 0);
+        if (pid < 0 && errno == ECHILD) sleep(1);
+        for (int i = 0; i < workers && pid > 0; ++i) {
+            if (pool[i] == pid) pool[i] = 0;
+        }
+    }
+
+    for (int i = 0; i < workers; ++i) {
+        if (pool[i] > 0) kill(pool[i], SIGTERM);
+    }
+    while (waitpid(-1, NULL, 0) > 0 || errno == EINTR);
+    free(pool);
+    unlink(path);
+    close(listen_fd);
+    return 0;
+}
+
+static char *build_request(const char *command, size_t *size) {
+    char *payload = NULL;
+    FILE *out = open_memstream(&payload, size);
+    if (!out) return NULL;
+
+    char *cwd = getcwd(NULL, 0);
+    if (cwd) fprintf(out, "C%s%c", cwd, '\0');
+    free(cwd);
+    for (char **entry = var_environ(); *entry; ++entry) fprintf(out, "E%s%c", *entry, '\0');
+    fprintf(out, "X%s%c", command, '\0');
+    fclose(out);
+    return payload;
+}
+
+static int send_request(int fd, const char *payload, size_t size) {
+    int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    union {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct iovec iov = { (void *)payload, size };
+    struct msghdr message = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = &control,
+            .msg_controllen = sizeof(control) };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    ssize_t n;
+    while ((n = sendmsg(fd, &message, 0)) < 0 && errno == EINTR);
+    if (n < 0) return -1;
+
+    for (size_t sent = n; sent < size; sent += n) {
+        n = write(fd, payload + sent, size - sent);
+        if (n < 0 && errno == EINTR) n = 0;
+        else if (n < 0) return -1;
+    }
+    return shutdown(fd, SHUT_WR);
+}
+
+/* Runs command on the server at path with this process's descriptors,
+ * directory and environment, and returns its status. The server's usage
+ * report is logged like a timing record when MYSHELL_TIMING_LOG is set. */
+int client_run(const char *path, const char *command) {
+    struct sockaddr_un address;
+    int fd = open_socket(path, &address);
+    if (fd < 0) return 127;
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address))) {
+        perror(path);
+        close(fd);
+        return 127;
+    }
+
+    size_t size;
+    char *payload = build_request(command, &size);
+    if (!payload || send_request(fd, payload, size)) {
+        perror("request failed");
+        free(payload);
+        close(fd);
+        return 127;
+    }
+    free(payload);
+
+    /* Background jobs may keep the connection open, so the reply ends at
+     * its newline rather than at end of file. */
+    char reply[256];
+    size_t length = 0;
+    while (length < sizeof(reply) - 1 && !memchr(reply, '\n', length)) {
+        ssize_t n = read(fd, reply + length, sizeof(reply) - 1 - length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        length += n;
+    }
+    reply[length] = '\0';
+    close(fd);
+
+    int status;
+    TimingSample sample;
+    if (sscanf(reply, "status=%d wall_ms=%lf user_ms=%lf sys_ms=%lf maxrss_kb=%ld nvcsw=%ld nivcsw=%ld", &status,
+            &sample.wall, &sample.user, &sample.sys, &sample.maxrss, &sample.nvcsw, &sample.nivcsw) != 7) {
+        fprintf(stderr, "%s: no reply from server\n", path);
+        return 127;
+    }
+    if (var_get(TIMING_LOG_VARIABLE)) {
+        sample.wall /= 1e3;
+        sample.user /= 1e3;
+        sample.sys /= 1e3;
+        timing_record("request", -1, command, status, &sample);
+    }
+    return status;
+}
@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "timing.h"
+#include "variables.h"
+#include "output.h"
+
+/* Usage of the foreground children reaped so far. ru_maxrss is the peak
+ * since the innermost running timing started. */
+static struct rusage children;
+
+static int log_fd = -1;
+static char *log_path = NULL;
+
+static double timespec_seconds(struct timespec ts) {
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double timeval_seconds(struct timeval tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void timeval_add(struct timeval *total, struct timeval add) {
+    total->tv_sec += add.tv_sec;
+    total->tv_usec += add.tv_usec;
+    if (total->tv_usec >= 1000000) {
+        total->tv_sec++;
+        total->tv_usec -= 1000000;
+    }
+}
+
+void timing_child(const struct rusage *usage) {
+    timeval_add(&children.ru_utime, usage->ru_utime);
+    timeval_add(&children.ru_stime, usage->ru_stime);
+    if (usage->ru_maxrss > children.ru_maxrss) children.ru_maxrss = usage->ru_maxrss;
+    children.ru_nvcsw += usage->ru_nvcsw;
+    children.ru_nivcsw += usage->ru_nivcsw;
+}
+
+void timing_start(Timing *timing) {
+    clock_gettime(CLOCK_MONOTONIC, &timing->start);
+    getrusage(RUSAGE_SELF, &timing->self);
+    timing->children = children;
+    timing->outer_maxrss = children.ru_maxrss;
+    children.ru_maxrss = 0;
+}
+
+void timing_stop(Timing *timing, TimingSample *sample) {
+    struct timespec end;
+    struct rusage self;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    getrusage(RUSAGE_SELF, &self);
+
+    sample->wall = timespec_seconds(end) - timespec_seconds(timing->start);
+    sample->user = timeval_seconds(self.ru_utime) - timeval_seconds(timing->self.ru_utime) +
+            timeval_seconds(children.ru_utime) - timeval_seconds(timing->children.ru_utime);
+    sample->sys = timeval_seconds(self.ru_stime) - timeval_seconds(timing->self.ru_stime) +
+            timeval_seconds(children.ru_stime) - timeval_seconds(timing->children.ru_stime);
+    sample->maxrss = children.ru_maxrss;
+    sample->nvcsw = self.ru_nvcsw - timing->self.ru_nvcsw + children.ru_nvcsw - timing->children.ru_nvcsw;
+    sample->nivcsw = self.ru_nivcsw - timing->self.ru_nivcsw + children.ru_nivcsw - timing->children.ru_nivcsw;
+
+    if (timing->outer_maxrss > children.ru_maxrss) children.ru_maxrss = timing->outer_maxrss;
+}
+
+/* A sample for one process, or a job, from its own wait4 usage. */
+void timing_sample(TimingSample *sample, const struct timespec *start, const struct timespec *end,
+        const struct rusage *usage) {
+    sample->wall = timespec_seconds(*end) - timespec_seconds(*start);
+    sample->user = timeval_seconds(usage->ru_utime);
+    sample->sys = timeval_seconds(usage->ru_stime);
+    sample->maxrss = usage->ru_maxrss;
+    sample->nvcsw = usage->ru_nvcsw;
+    sample->nivcsw = usage->ru_nivcsw;
+}
+
+/* The log is reopened only when the variable names another file. Kept
+ * away from the low descriptors that redirections use. */
+static int open_log(const char *path) {
+    if (log_fd >= 0 && !strcmp(log_path, path)) return log_fd;
+
+    if (log_fd >= 0) close(log_fd);
+    free(log_path);
+    log_path = strdup(path);
+    log_fd = -1;
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        perror(path);
+        return -1;
+    }
+    log_fd = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+    close(fd);
+    return log_fd;
+}
+
+static void json_string(FILE *out, const char *text) {
+    fputc('"', out);
+    for (const unsigned char *p = (const unsigned char *)text; *p; ++p) {
+        if (*p == '"' || *p == '\\') fprintf(out, "\\%c", *p);
+        else if (*p == '\n') fputs("\\n", out);
+        else if (*p == '\t') fputs("\\t", out);
+        else if (*p < 0x20) fprintf(out, "\\u%04x", *p);
+        else fputc(*p, out);
+    }
+    fputc('"', out);
+}
+
+/* Reports one command, pipeline stage or job. With MYSHELL_TIMING_LOG set
+ * the record is a JSON line appended to that file in a single write, so
+ * that records of forked shells do not interleave; otherwise it is a line
+ * on stderr. index is the stage or job number, or -1. */
+void timing_record(const char *kind, int index, const char *command, int status, const TimingSample *sample) {
+    const char *path = var_get(TIMING_LOG_VARIABLE);
+    if (!path || !*path) {
+        output_flush_all();
+        fprintf(stderr, "timing: %s", kind);
+        if (index >= 0) fprintf(stderr, " %d", index);
+        fprintf(stderr, " '%s' status %d, wall %.3fs, user %.3fs, sys %.3fs, maxrss %ldkB, switches %ld/%ld\n",
+                command, status, sample->wall, sample->user, sample->sys, sample->maxrss, sample->nvcsw,
+                sample->nivcsw);
+        return;
+    }
+
+    int fd = open_log(path);
+    if (fd < 0) return;
+
+    char *line = NULL;
+    size_t length = 0;
+    FILE *out = open_memstream(&line, &length);
+    if (!out) return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    fprintf(out, "{\"ts\":%.6f,\"pid\":%d,\"kind\":\"%s\",", timespec_seconds(now), (int)getpid(), kind);
+    if (index >= 0) fprintf(out, "\"%s\":%d,", kind, index);
+    fputs("\"command\":", out);
+    json_string(out, command);
+    fprintf(out, ",\"status\":%d,\"wall_ms\":%.3f,\"user_ms\":%.3f,\"sys_ms\":%.3f,\"maxrss_kb\":%ld,"
+            "\"nvcsw\":%ld,\"nivcsw\":%ld}\n", status, sample->wall * 1e3, sample->user * 1e3,
+            sample->sys * 1e3, sample->maxrss, sample->nvcsw, sample->nivcsw);
+    fclose(out);
+
+    if (write(fd, line, length) != (ssize_t)length) perror(path);
+    free(line);
+}
+
+/* The report of the time keyword. */
+void timing_print(const TimingSample *sample) {
+    const char *names[] = { "real", "user", "sys" };
+    double values[] = { sample->wall, sample->user, sample->sys };
+
+    output_flush_all();
+    fputc('\n', stderr);
+    for (int i = 0; i < 3; ++i) {
+        int minutes = (int)(values[i] / 60);
+        fprintf(stderr, "%s\t%dm%.3fs\n", names[i], minutes, values[i] - minutes * 60);
+    }
+}
@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "trace.h"
+#include "variables.h"
+
+bool trace_enabled = false;
+static int trace_fd = -1;
+
+uint64_t trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/* Opens the trace named by MYSHELL_TRACE and starts the array when the file
+ * is new. The descriptor is shared with forked shells and kept away from
+ * the ones redirections use. */
+void trace_init(void) {
+    const char *path = var_get(TRACE_VARIABLE);
+    if (!path || !*path) return;
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        perror(path);
+        return;
+    }
+    trace_fd = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+    close(fd);
+    if (trace_fd == -1) return;
+
+    struct stat st;
+    if (!fstat(trace_fd, &st) && st.st_size == 0 && write(trace_fd, "[\n", 2) != 2) {
+        perror(path);
+        return;
+    }
+    trace_enabled = true;
+}
+
+/* Writes the span from start until now as one event. detail, which may be
+ * NULL, is shortened to TRACE_DETAIL_MAX bytes. A single write keeps events
+ * from different processes whole. */
+void trace_event(const char *name, uint64_t start, const char *detail) {
+    uint64_t end = trace_now();
+    char line[TRACE_DETAIL_MAX * 6 + 256];
+    int pid = (int)getpid();
+    int length = snprintf(line, sizeof(line), "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+            "\"ts\":%.3f,\"dur\":%.3f", name, pid, pid, start / 1e3, (end - start) / 1e3);
+
+    if (detail) {
+        length += snprintf(line + length, sizeof(line) - length, ",\"args\":{\"detail\":\"");
+        for (size_t i = 0; detail[i] && i < TRACE_DETAIL_MAX; ++i) {
+            unsigned char c = detail[i];
+            if (c == '"' || c == '\\') length += snprintf(line + length, sizeof(line) - length, "\\%c", c);
+            else if (c < 0x20) length += snprintf(line + length, sizeof(line) - length, "\\u%04x", c);
+            else line[length++] = c;
+        }
+        length += snprintf(line + length, sizeof(line) - length, "\"}");
+    }
+    length += snprintf(line + length, sizeof(line) - length, "},\n");
+
+    if (write(trace_fd, line, length) != length) trace_enabled = false;
+}
@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "variables.h"
+#include "arena.h"
+#include "pathcache.h"
+
+static Variable *slots = NULL;
+static int slot_count = 0;
+static int used_slots = 0;
+static Arena names;
+static const char *path_name = NULL;
+
+/* The environment handed to new programs; rebuilt only after an exported
+ * variable changed. */
+static char **env = NULL;
+static int env_capacity = 0;
+static bool env_dirty = true;
+
+static unsigned int hash_name(const char *name, size_t length) {
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static Variable *probe(Variable *table, int count, const char *name, size_t length, unsigned int hash) {
+    for (int i = hash & (count - 1);; i = (i + 1) & (count - 1)) {
+        Variable *slot = &table[i];
+        if (!slot->name) return slot;
+        if (slot->hash == hash && !strncmp(slot->name, name, length) && !slot->name[length]) return slot;
+    }
+}
+
+static void vars_grow(void) {
+    int new_count = slot_count ? slot_count * 2 : VAR_INITIAL_SLOTS;
+    Variable *table = calloc(new_count, sizeof(Variable));
+
+    for (int i = 0; i < slot_count; ++i) {
+        if (!slots[i].name) continue;
+        *probe(table, new_count, slots[i].name, strlen(slots[i].name), slots[i].hash) = slots[i];
+    }
+    free(slots);
+    slots = table;
+    slot_count = new_count;
+}
+
+static Variable *find(const char *name, size_t length) {
+    if (!slot_count) return NULL;
+    Variable *slot = probe(slots, slot_count, name, length, hash_name(name, length));
+    return slot->name ? slot : NULL;
+}
+
+/* Returns the slot for name, interning the name on first use. */
+static Variable *intern(const char *name, size_t length) {
+    if ((used_slots + 1) * 4 > slot_count * 3) vars_grow();
+
+    unsigned int hash = hash_name(name, length);
+    Variable *slot = probe(slots, slot_count, name, length, hash);
+    if (!slot->name) {
+        slot->name = arena_strndup(&names, name, length);
+        slot->hash = hash;
+        used_slots++;
+    }
+    return slot;
+}
+
+static void changed(Variable *slot, bool was_exported) {
+    if (slot->exported || was_exported) env_dirty = true;
+    if (slot->name == path_name) path_cache_invalidate();
+}
+
+static void assign(Variable *slot, const char *value, size_t value_length) {
+    size_t name_length = strlen(slot->name);
+    char *entry = malloc(name_length + value_length + 2);
+    memcpy(entry, slot->name, name_length);
+    entry[name_length] = '=';
+    memcpy(entry + name_length + 1, value, value_length);
+    entry[name_length + value_length + 1] = '\0';
+
+    free(slot->entry);
+    slot->entry = entry;
+    slot->value = entry + name_length + 1;
+}
+
+void vars_init(char **envp) {
+    arena_init(&names);
+    path_name = intern("PATH", 4)->name;
+
+    for (char **entry = envp; *entry; ++entry) {
+        const char *eq = strchr(*entry, '=');
+        if (!eq || eq == *entry) continue;
+        Variable *slot = intern(*entry, eq - *entry);
+        assign(slot, eq + 1, strlen(eq + 1));
+        slot->exported = true;
+    }
+    env_dirty = true;
+}
+
+const char *var_lookup(const char *name, size_t length) {
+    Variable *slot = find(name, length);
+    return slot && slot->entry ? slot->value : NULL;
+}
+
+const char *var_get(const char *name) {
+    return var_lookup(name, strlen(name));
+}
+
+bool var_is_exported(const char *name) {
+    Variable *slot = find(name, strlen(name));
+    return slot && slot->exported;
+}
+
+/* Sets name to value; export also marks it for the environment. A variable
+ * that is already exported stays exported. */
+void var_set(const char *name, const char *value, bool export) {
+    Variable *slot = intern(name, strlen(name));
+    bool was_exported = slot->exported;
+    assign(slot, value, strlen(value));
+    if (export) slot->exported = true;
+    changed(slot, was_exported);
+}
+
+void var_set_exported(const char *name, bool exported) {
+    Variable *slot = intern(name, strlen(name));
+    if (slot->exported == exported) return;
+    slot->exported = exported;
+    if (slot->entry) env_dirty = true;
+}
+
+void var_unset(const char *name) {
+    Variable *slot = find(name, strlen(name));
+    if (!slot || !slot->entry) return;
+
+    bool was_exported = slot->exported;
+    free(slot->entry);
+    slot->entry = NULL;
+    slot->value = NULL;
+    slot->exported = false;
+    changed(slot, was_exported);
+}
+
+char **var_environ(void) {
+    if (!env_dirty) return env;
+
+    int count = 0;
+    for (int i = 0; i < slot_count; ++i) {
+        if (slots[i].entry && slots[i].exported) count++;
+    }
+    if (count + 1 > env_capacity) {
+        env_capacity = count + 1 > 2 * env_capacity ? count + 1 : 2 * env_capacity;
+        env = realloc(env, env_capacity * sizeof(char *));
+    }
+
+    count = 0;
+    for (int i = 0; i < slot_count; ++i) {
+        if (slots[i].entry && slots[i].exported) env[count++] = slots[i].entry;
+    }
+    env[count] = NULL;
+    env_dirty = false;
+    return env;
+}
+
+void var_snapshot(Arena *arena, VarSnapshot *snapshot) {
+    int count = 0;
+    for (int i = 0; i < slot_count; ++i) {
+        if (slots[i].entry) count++;
+    }
+    snapshot->entries = arena_alloc(arena, count * sizeof(char *));
+    snapshot->exported = arena_alloc(arena, count * sizeof(bool));
+    snapshot->count = 0;
+    for (int i = 0; i < slot_count; ++i) {
+        if (!slots[i].entry) continue;
+        snapshot->entries[snapshot->count] = arena_strdup(arena, slots[i].entry);
+        snapshot->exported[snapshot->count++] = slots[i].exported;
+    }
+}
+
+/* Replaces every variable with those of the snapshot. */
+void var_restore(const VarSnapshot *snapshot) {
+    for (int i = 0; i < slot_count; ++i) {
+        if (slots[i].entry) var_unset(slots[i].name);
+    }
+    for (int i = 0; i < snapshot->count; ++i) {
+        const char *entry = snapshot->entries[i];
+        const char *eq = strchr(entry, '=');
+        Variable *slot = intern(entry, eq - entry);
+        assign(slot, eq + 1, strlen(eq + 1));
+        slot->exported = snapshot->exported[i];
+        changed(slot, false);
+    }
+}
@@ -0,0 +1,54 @@
+# Control flow that the compiler lowers to instructions, mixed with the
+# constructs it leaves to the tree-walker.
+i=
+while [ "$i" != xxx ]; do
+    i=${i}x
+    if [ $i = xx ]; then continue; fi
+    echo "while $i"
+done
+until [ "$n" = 111 ]; do n=${n}1; done; echo "until $n"
+
+for a in 1 2 3; do
+    for b in x y z; do
+        [ $b = y ] && continue
+        [ $a = 2 ] && continue 2
+        [ $a = 3 ] && break 2
+        echo "for $a$b"
+    done
+done
+for w in one "two three"; do echo "[$w]"; done
+set -- p q
+for p; do echo "param $p"; done
+
+if false; then echo no; elif true; then echo elif; else echo else; fi
+if false; then echo no; fi; echo "if status $?"
+true && false || echo "or after and"
+false && echo no; echo "and status $?"
+
+f() {
+    for k in 1 2 3; do
+        [ $k = 2 ] && return 7
+        echo "f $k"
+    done
+}
+f; echo "return $?"
+g() { echo "g $1 $#"; }; g a b
+h() { g "$@" | tr g h; }; h c
+
+{ echo grouped; echo redirected; } > /tmp/myshell_control.out
+cat /tmp/myshell_control.out
+while read line; do echo "read $line"; done < /tmp/myshell_control.out
+for v in 1 2; do echo "loop $v"; done | tr l L
+cd /tmp; (cd /; echo "sub $(pwd)"); echo "after $(pwd)"
+(exit 3); echo "subshell status $?"
+echo piped | while read x; do echo "stage $x"; done
+{ sleep 0.1; echo background; } & wait
+x=outer; (x=inner); echo $x
+rm -f /tmp/myshell_control.out
+
+# set -- replaces $1... inside and outside functions, and for goes over
+# the words it started with.
+f() { set -- a b c; echo "$# $1"; }
+f x; f y
+set -- 1 2 3
+for i; do set -- z; echo $i; done; echo $1 $#
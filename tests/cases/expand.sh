@@ -0,0 +1,6 @@
+# A failed expansion skips its command with status 1.
+echo ${x!} after; echo status $?
+echo ${x!} | cat; echo status $?
+for i in a ${x!}; do echo loop $i; done; echo status $?
+v=$(echo ${x!}); echo "[$v]" $?
+echo ${1=z}; echo status $?
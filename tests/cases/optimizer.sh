@@ -0,0 +1,22 @@
+# Rewrites that assume a name is not a function must notice one defined
+# later on the same line, or after the line was cached.
+cd /tmp
+mycmd() { cd /; }; (mycmd); pwd
+true() { return 1; }; true && echo folded; echo $?
+unset -f true
+
+for i in 1 2; do (ls -d /tmp); ls() { echo ls function; }; done
+unset -f ls
+for i in 1 2; do false || echo $i; false() { return 0; }; done
+unset -f false
+for i in 1 2; do cat /dev/null | wc -l; cat() { echo cat function; }; done
+unset -f cat
+for i in 1 2; do (echo a | tr a b); tr() { echo tr function; }; done
+unset -f tr
+
+# Only a plain command after cat can take its file as input.
+echo abc > /tmp/myshell_optimizer_$$
+cat /tmp/myshell_optimizer_$$ | { tr a-z A-Z; } | cat
+cat /tmp/myshell_optimizer_$$ | while read l; do echo got $l; done | cat
+cat /tmp/myshell_optimizer_$$ | (tr a-z A-Z) | cat
+rm -f /tmp/myshell_optimizer_$$
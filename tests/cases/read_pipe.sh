@@ -0,0 +1,6 @@
+# A script piped into the shell leaves the lines it has not run yet for the
+# commands that read stdin.
+printf 'read a b\none two\necho "$a:$b"\n' | ../myshell
+printf 'read x\nfirst\nread y\nsecond\necho "$x $y"\n' | ../myshell
+printf 'cat\nfor cat\n' | ../myshell
+printf 'while read line; do echo "got $line"; done\nalpha\nbeta\n' | ../myshell
@@ -0,0 +1,27 @@
+#!/bin/sh
+# Runs every tests/cases/NAME.sh with myshell from the tests directory and
+# compares what it prints, stderr included, with tests/cases/NAME.out. Each
+# script runs twice: compiled, and walked as a tree under set +o compile.
+cd "$(dirname "$0")" || exit 1
+shell=../myshell
+walked=$(mktemp) || exit 1
+trap 'rm -f "$walked"' EXIT
+failed=0
+
+for script in cases/*.sh; do
+    expected="${script%.sh}.out"
+    { echo 'set +o compile'; cat "$script"; } > "$walked"
+    for mode in compiled walked; do
+        file=$script
+        [ "$mode" = walked ] && file=$walked
+        if "$shell" "$file" < /dev/null 2>&1 | diff -u "$expected" - > /dev/null; then
+            echo "PASS $script ($mode)"
+        else
+            echo "FAIL $script ($mode)"
+            "$shell" "$file" < /dev/null 2>&1 | diff -u "$expected" -
+            failed=$((failed + 1))
+        fi
+    done
+done
+
+[ "$failed" -eq 0 ]